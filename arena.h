@@ -0,0 +1,58 @@
+/// \file arena.h
+/// \brief Pool (arena) allocator for the small objects created while building the H-Matrix.
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <vector>
+#include <new>
+#include <cstddef>
+
+/// The arena hands out objects of type T from large chunks by bump-pointer allocation: there is one heap allocation per chunk instead of one per object,
+/// the objects never move, and all of them are destroyed together when the arena is cleared or destroyed.
+/// 'create' is not thread-safe; objects filled inside a parallel loop are created before the loop.
+template<class T>
+class arena
+{
+private:
+	std::vector<T*> chunks;
+	std::size_t chunk_size; // number of objects per chunk
+	std::size_t n_used; // number of objects created in the last chunk
+	// the arena owns its objects: no copies
+	arena(const arena&);
+	arena& operator=(const arena&);
+public:
+	arena(std::size_t n=256) : chunk_size(n), n_used(n) {}
+	~arena() { clear(); }
+	/// Returns a pointer to a new default constructed object.
+	T* create(void)
+	{
+		if(n_used==chunk_size)
+		{
+			chunks.push_back(static_cast<T*>(::operator new(chunk_size*sizeof(T))));
+			n_used = 0;
+		}
+		T* obj = new (chunks.back()+n_used) T();
+		n_used++;
+		return obj;
+	}
+	/// Destroys all objects and releases the chunks.
+	void clear(void)
+	{
+		for(std::size_t c=0;c<chunks.size();c++)
+		{
+			std::size_t n = (c+1==chunks.size()) ? n_used : chunk_size;
+			for(std::size_t i=0;i<n;i++)
+				chunks[c][i].~T();
+			::operator delete(chunks[c]);
+		}
+		chunks.clear();
+		n_used = chunk_size;
+	}
+	/// Number of objects created.
+	std::size_t size(void) const { return chunks.empty() ? 0 : (chunks.size()-1)*chunk_size + n_used; }
+	/// Bytes reserved by the chunks; memory owned by the objects themselves is not included.
+	std::size_t memory_usage(void) const { return chunks.size()*chunk_size*sizeof(T); }
+};
+
+#endif
@@ -2,217 +2,218 @@
 /// \brief Class for storage and manipulation of block cluster trees (quad-tree).
 
 #include "block_cluster.h"
-#include <queue>
 #include <iostream>
 #include <fstream>
 
 bctree::bctree()
 {
-	bct_node* ptr = new bct_node;
-	ptr->cluster1 = NULL;
-	ptr->cluster2 = NULL;
-	ptr->left = NULL;
-	ptr->left_left = NULL;
-	ptr->right = NULL;
-	ptr->right_right = NULL;
-	ptr->type=3;
-	root = ptr;
+	bct_node root;
+	root.cluster1 = 0;
+	root.cluster2 = 0;
+	root.first_child = 0;
+	root.n_child = 0;
+	root.type=3;
+	nodes.push_back(root);
+	level_offset.push_back(0);
+	level_offset.push_back(1);
+	ct = NULL;
 }
 
 void bctree::block_cluster(tree& bt, std::vector<graph_cluster*>& graphs, int leaf_size)
 {
-    int verbose=0;
-	// initialize a queue for traversal of block cluster tree as it is created
-	root->cluster1 = bt.get_root();
-	root->cluster2 = bt.get_root();
-
-	std::queue <bct_node*> bct_nodes;
-	bct_nodes.push(root);
-	bct_node* current_node = new bct_node;
-	while(!bct_nodes.empty())
+	ct = &bt;
+	// the root is the product of the root of the cluster tree with itself
+	nodes.resize(1);
+	nodes[0].cluster1 = bt.node_index(bt.get_root());
+	nodes[0].cluster2 = bt.node_index(bt.get_root());
+	nodes[0].first_child = 0;
+	nodes[0].n_child = 0;
+	nodes[0].type = 3;
+	level_offset.clear();
+	level_offset.push_back(0);
+	level_offset.push_back(1);
+
+	// level-synchronous build: the nodes of one level are independent, so every level is classified in parallel,
+	// the children are placed behind the level by a prefix sum over the number of children, and then written in parallel
+	// the node array is the same as for a BFS with a queue
+	bool error = false;
+	for(unsigned int l=0; l+1<level_offset.size() && !error; l++)
 	{
-		if (verbose)
-            std::cout<<"----->>---------->>----------"<<std::endl;
-		current_node = bct_nodes.front();
-		bct_nodes.pop();
-		// clus1 and clus2 are the two nodes of cluster tree for current node in bct
-		node* clus1 = current_node->cluster1;
-		node* clus2 = current_node->cluster2;
-
+		int begin = level_offset[l];
+		int end = level_offset[l+1];
 
-		// check the size clusters: leaf-size condition
-		int size1 = clus1->data.size();
-		int size2 = clus2->data.size();
-		//std::cout<<"DB: size1: "<<size1<<" size2: "<<size2<<std::endl;
-		if(size1 <= leaf_size || size2 <= leaf_size)
-		{
-			// this is a dense node: skip it
-			if (verbose)
-                std::cout<<"Dense Block!"<<std::endl;
-			//std::cout<<"bt_idx1: "<<clus1->bt_idx<<" bt_idx2: "<<clus2->bt_idx<<std::endl;
-			current_node->type = 2;
-		}
-		else
+		// 1. type and number of children of every node of this level
+		#pragma omp parallel for schedule(dynamic,256)
+		for(int i=begin;i<end;i++)
 		{
+			bct_node* current_node = &nodes[i];
+			current_node->n_child = 0;
+			// clus1 and clus2 are the two nodes of cluster tree for current node in bct
+			node* clus1 = bt.get_node(current_node->cluster1);
+			node* clus2 = bt.get_node(current_node->cluster2);
+
+			// check the size clusters: leaf-size condition
+			int size1 = clus1->size();
+			int size2 = clus2->size();
+			if(size1 <= leaf_size || size2 <= leaf_size)
+			{
+				// this is a dense node
+				current_node->type = 2;
+				continue;
+			}
+
 			// Admissibility Condition
 			// Check if connected in graph or not
 			if(clus1->level!=clus2->level)
 			{
-				std::cout<<"Block_Cluster: How can the two nodes be from different levels?"<<std::endl;
-				break;
+				#pragma omp critical
+				{
+					std::cout<<"Block_Cluster: How can the two nodes be from different levels?"<<std::endl;
+					error = true;
+				}
+				continue;
 			}
 
 			int connection=0;
-
 			if(clus1->bt_idx == clus2->bt_idx)
 				connection = 1;
 			else
 			{
-			    unsigned int dum_el = graphs.size() - clus1->level;
+				unsigned int dum_el = graphs.size() - clus1->level;
 				graph_cluster* current_graph = graphs.at(dum_el);
 				connection = current_graph->edge_weight(clus1->bt_idx, clus2->bt_idx);
 			}
-			if (verbose)
-                std::cout<<"connection: "<<connection<<std::endl;
-			if(connection)
-			{
-				// Inadmissible Block
-
-				// retrieve children of both the nodes
-                if (verbose)
-                    std::cout<<"Inadm. block!"<<std::endl;
-				current_node->type=3;
-				if (verbose)
-                    std::cout<<"bt_idx1: "<<clus1->bt_idx<<" bt_idx2: "<<clus2->bt_idx<<std::endl;
 
-				std::vector<node*> clus1_child;
-				clus1_child.push_back(clus1->left);
-				clus1_child.push_back(clus1->right);
-				std::vector<node*> clus2_child;
-				clus2_child.push_back(clus2->left);
-				clus2_child.push_back(clus2->right);
-				//std::cout<<"size(bct_nodes): "<<bct_nodes.size()<<std::endl;
-				// cartesian product of these children
-				// as cluster tree is a binary tree, every node must have atmost 2 children
-				if (verbose)
-                    std::cout<<"child_size1: "<<clus1_child.size()<<" child_size2: "<<clus2_child.size()<<std::endl;
-				for(std::vector<node*>::iterator c2 = clus2_child.begin(); c2!= clus2_child.end(); ++c2)
-				{
-					for(std::vector<node*>::iterator c1 = clus1_child.begin(); c1!=clus1_child.end(); ++c1)
-					{
-						//std::cout<<"cp"<<std::endl;
-						//std::cout<<"	size(bct_nodes): "<<bct_nodes.size()<<std::endl;
-						bct_node* dum_ptr = new bct_node;
-						dum_ptr->cluster1 = *c1;
-						dum_ptr->cluster2 = *c2;
-						dum_ptr->left_left = NULL;
-						dum_ptr->left = NULL;
-						dum_ptr->right = NULL;
-						dum_ptr->right_right = NULL;
-						dum_ptr->type=3;
-						if(*c1==NULL || *c2==NULL)
-							continue;
-						if(current_node->left_left == NULL)
-						{
-                            //std::cout<<"1"<<std::endl;
-							current_node->left_left = dum_ptr;
-							bct_nodes.push(current_node->left_left);
-						}
-						else if(current_node->left == NULL)
-						{
-                            //std::cout<<"2"<<std::endl;
-							current_node->left = dum_ptr;
-							bct_nodes.push(current_node->left);
-						}
-						else if(current_node->right == NULL)
-						{
-                            //std::cout<<"3"<<std::endl;
-							current_node->right = dum_ptr;
-							bct_nodes.push(current_node->right);
-						}
-						else if(current_node->right_right == NULL)
-						{
-                            //std::cout<<"4"<<std::endl;
-							current_node->right_right = dum_ptr;
-							bct_nodes.push(current_node->right_right);
-						}
-					}
-				}
-				if (verbose)
-                    std::cout<<"Cartesian product completed!"<<std::endl;
-				//std::cout<<"size(bct_nodes): "<<bct_nodes.size()<<std::endl;
+			if(connection && (clus1->n_child==0 || clus2->n_child==0))
+			{
+				// leaf cluster which is larger than the leaf size: cannot be split further
+				current_node->type = 2;
+			}
+			else if(connection)
+			{
+				// Inadmissible Block: cartesian product of the children
+				// a binary cluster tree gives four children; a tree from k-way aggregation up to k*k
+				current_node->type = 3;
+				current_node->n_child = clus1->n_child*clus2->n_child;
 			}
 			else
 			{
 				// Admissible Block
-				if (verbose)
-                    std::cout<<"Adm. block!"<<std::endl;
-				//std::cout<<"bt_idx1: "<<clus1->bt_idx<<" bt_idx2: "<<clus2->bt_idx<<std::endl;
-				current_node->type=1;
+				current_node->type = 1;
 			}
+		}
 
+		// 2. prefix sum: the children of this level form the next level, in the order of their parents
+		unsigned int next = end;
+		for(int i=begin;i<end;i++)
+		{
+			nodes[i].first_child = next;
+			next += nodes[i].n_child;
+		}
+		if(next==(unsigned int)end)
+			break;
+		nodes.resize(next);
+		level_offset.push_back(next);
+
+		// 3. children of the inadmissible blocks, written into their slots of the next level
+		#pragma omp parallel for schedule(dynamic,256)
+		for(int i=begin;i<end;i++)
+		{
+			const bct_node* current_node = &nodes[i];
+			if(current_node->n_child==0)
+				continue;
+			node* clus1 = bt.get_node(current_node->cluster1);
+			node* clus2 = bt.get_node(current_node->cluster2);
+			unsigned int n1 = clus1->n_child, first1 = clus1->first_child;
+			unsigned int n2 = clus2->n_child, first2 = clus2->first_child;
+			bct_node* child = &nodes[current_node->first_child];
+			for(unsigned int c2=0; c2<n2; c2++)
+			{
+				for(unsigned int c1=0; c1<n1; c1++)
+				{
+					child->cluster1 = first1 + c1;
+					child->cluster2 = first2 + c2;
+					child->first_child = 0;
+					child->n_child = 0;
+					child->type = 3;
+					++child;
+				}
+			}
 		}
 	}
-	current_node=NULL;
-	delete current_node;
+}
+
+bct_node* bctree::get_node(unsigned int i)
+{
+	return &nodes[i];
+}
+
+bct_node* bctree::get_child(const bct_node* n, unsigned int c)
+{
+	return &nodes[n->first_child + c];
+}
+
+unsigned int bctree::n_nodes(void)
+{
+	return nodes.size();
+}
+
+int bctree::n_levels(void)
+{
+	return level_offset.size()-1;
+}
+
+unsigned int bctree::level_begin(int l)
+{
+	return level_offset.at(l);
+}
+
+unsigned int bctree::level_end(int l)
+{
+	return level_offset.at(l+1);
+}
+
+std::size_t bctree::memory_usage(void)
+{
+	return nodes.capacity()*sizeof(bct_node) + level_offset.capacity()*sizeof(unsigned int);
+}
+
+node* bctree::row_cluster(const bct_node* n)
+{
+	return ct->get_node(n->cluster1);
+}
+
+node* bctree::col_cluster(const bct_node* n)
+{
+	return ct->get_node(n->cluster2);
 }
 
 // output bct to a file
 void bctree::output(){
 
-    std::queue <bct_node*> bct_nodes;
-	bct_nodes.push(root);
-	bct_node* current_node = new bct_node;
 	std::ofstream myfile;
 	myfile.open("block.txt");
 
-	while(!bct_nodes.empty()){
-        current_node = bct_nodes.front();
-		bct_nodes.pop();
-        if(current_node!=NULL){
-            int node_type = current_node->type;
-            if(node_type==1){
-                // rk block
-                myfile<<node_type<<",";
-                std::vector<unsigned int> clus1, clus2;
-                clus1 = current_node->cluster1->data;
-                clus2 = current_node->cluster2->data;
-                for(std::vector<unsigned int>::iterator itr = clus1.begin();itr!=clus1.end();++itr){
-                    myfile<<*itr<<",";
-                }
-                myfile<<-1077<<",";
-                for(std::vector<unsigned int>::iterator itr = clus2.begin();itr!=clus2.end();++itr){
-                    myfile<<*itr<<",";
-                }
-                myfile<<"\n";
-            }else if (node_type==2){
-                // full block
-
-                myfile<<node_type<<",";
-                std::vector<unsigned int> clus1, clus2;
-                clus1 = current_node->cluster1->data;
-                clus2 = current_node->cluster2->data;
-                for(std::vector<unsigned int>::iterator itr = clus1.begin();itr!=clus1.end();++itr){
-                    myfile<<*itr<<",";
-                }
-                myfile<<-1077<<",";
-                for(std::vector<unsigned int>::iterator itr = clus2.begin();itr!=clus2.end();++itr){
-                    myfile<<*itr<<",";
-                }
-                myfile<<"\n";
-
-            }else{
-                // internal node
-                bct_nodes.push(current_node->left);
-                bct_nodes.push(current_node->left_left);
-                bct_nodes.push(current_node->right);
-                bct_nodes.push(current_node->right_right);
+	// the leaves are written in BFS order
+	for(unsigned int n=0;n<nodes.size();n++){
+        bct_node* current_node = &nodes[n];
+        int node_type = current_node->type;
+        if(node_type==1 || node_type==2){
+            // rk block or full block
+            myfile<<node_type<<",";
+            node* clus1 = row_cluster(current_node);
+            node* clus2 = col_cluster(current_node);
+            for(unsigned int i=clus1->begin;i<clus1->end;i++){
+                myfile<<i<<",";
             }
+            myfile<<-1077<<",";
+            for(unsigned int i=clus2->begin;i<clus2->end;i++){
+                myfile<<i<<",";
+            }
+            myfile<<"\n";
         }
 	}
 	myfile.close();
-	current_node = NULL;
-	delete current_node;
 
 }
 
@@ -220,52 +221,34 @@ void bctree::output(){
 std::ostream& operator<<(std::ostream& os, bctree& bt)
 {
 	os<<"-----------------------------------------------------"<<"\n";
-	std::queue <bct_node*> bt_nodes;
-	bt_nodes.push(bt.get_root());
 	os<<"BFS of block cluster tree: \n";
-	bct_node* current_node = new bct_node;
-	while(!bt_nodes.empty())
+	for(unsigned int n=0;n<bt.n_nodes();n++)
 	{
-		current_node = bt_nodes.front();
-		bt_nodes.pop();
-		if(current_node!=NULL)
+		bct_node* current_node = bt.get_node(n);
+		node* clus1 = bt.row_cluster(current_node);
+		node* clus2 = bt.col_cluster(current_node);
+		os<<" C1: <- ";
+		for(unsigned int i=clus1->begin; i<clus1->end; i++)
 		{
-			std::vector<unsigned int> current_data = current_node->cluster1->data;
-            std::vector<unsigned int> current_data1 = current_node->cluster2->data;
-			//os<<" <- level: "<< current_node->level<<" - ";
-			os<<" C1: <- ";
-			for(std::vector<unsigned int>::iterator itr = current_data.begin(); itr!= current_data.end(); ++ itr)
-			{
-				os<<" "<<*itr<<" ";
-			}
-			os<<"-> ";
-            os<<" C2: <- ";
-			for(std::vector<unsigned int>::iterator itr = current_data1.begin(); itr!= current_data1.end(); ++ itr)
-			{
-				os<<" "<<*itr<<" ";
-			}
-			os<<"-> ";
-			os<<"<- Type= ";
-			os<<current_node->type;
-			os<<"->";
-			os<<" | ";
-			bt_nodes.push(current_node->left_left);
-            bt_nodes.push(current_node->left);
-			bt_nodes.push(current_node->right);
-            bt_nodes.push(current_node->right_right);
+			os<<" "<<i<<" ";
 		}
-		else
+		os<<"-> ";
+		os<<" C2: <- ";
+		for(unsigned int i=clus2->begin; i<clus2->end; i++)
 		{
-			os<<" <- "<<" NULL "<<" -> ";
+			os<<" "<<i<<" ";
 		}
+		os<<"-> ";
+		os<<"<- Type= ";
+		os<<current_node->type;
+		os<<"->";
+		os<<" | ";
 	}
 	os<<"\n";
-	current_node=NULL;
-	delete current_node;
 	return os;
 }
 
 bct_node* bctree::get_root(void)
 {
-    return root;
+    return &nodes[0];
 }
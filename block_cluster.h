@@ -1,4 +1,4 @@
-// struct for holding block cluster tree: as the tree may be sparse, vectors are not space efficient
+// struct for holding block cluster tree: the nodes are kept in one array in BFS order, children are referred to by index
 //! This class can be used for a block cluster tree.
 #ifndef BLOCK_H
 #define BLOCK_H
@@ -8,34 +8,49 @@
 #include <vector>
 
 /// "bct_node" represents a node in the block cluster tree and it consists of the following attributes:
-/// 1. cluster1: vector to hold data from the 1st set used for cartesian product.
-/// 2. cluster2: vector to hold data from the 2nd set used for cartesian product.
-/// 3. left_left: a pointer to the left most child.
-/// 4. left: a pointer to the left child.
-/// 5. right: a pointer to the right child.
-/// 6. right_right: a pointer to the right most child.
-/// 7. type: rk or full or to be split.
+/// 1. cluster1: index of the node of the cluster tree holding the 1st set used for cartesian product (rows).
+/// 2. cluster2: index of the node of the cluster tree holding the 2nd set used for cartesian product (cols).
+/// 3. first_child, n_child: the children, one for every pair of children of cluster1 and cluster2 (four for a binary cluster tree), are stored contiguously in the node array of the block cluster tree.
+/// 4. type: rk or full or to be split.
 struct bct_node
 {
-	node* cluster1;
-	node* cluster2;
-	bct_node* left_left;
-	bct_node* left;
-	bct_node* right;
-	bct_node* right_right;
+	unsigned int cluster1;
+	unsigned int cluster2;
+	unsigned int first_child;
+	unsigned int n_child;
 	int type;
 };
 
+/// The nodes are stored in one array in BFS order, like the nodes of the cluster tree: the root is the first node, the nodes of every level and the children of every node are contiguous.
 class bctree
 {
 private:
-	bct_node* root;
+	std::vector<bct_node> nodes;
+	std::vector<unsigned int> level_offset; // the nodes of level 'l' are nodes[level_offset[l]] ... nodes[level_offset[l+1]-1]
+	tree* ct; // cluster tree which the clusters refer to
 public:
 	bctree();
 	/// Creates the block cluster tree using cluster tree, graphs and number of cols as input.
+	/// The tree is built level by level: the nodes of a level are classified in parallel and their children are placed in the next level by a prefix sum.
 	void block_cluster(tree&, std::vector<graph_cluster*>&, int);
 	/// Helper function; returns a pointer to the root of the block cluster tree.
 	bct_node* get_root(void);
+	/// Returns a pointer to node 'i' of the node array.
+	bct_node* get_node(unsigned int i);
+	/// Returns a pointer to child 'c' of the given node.
+	bct_node* get_child(const bct_node*, unsigned int c);
+	/// Number of nodes in the block cluster tree.
+	unsigned int n_nodes(void);
+	/// Number of levels in the block cluster tree.
+	int n_levels(void);
+	/// The nodes of level 'l' are the nodes level_begin(l) ... level_end(l)-1 of the node array.
+	unsigned int level_begin(int l);
+	unsigned int level_end(int l);
+	/// Memory held by the node array and the level offsets in bytes.
+	std::size_t memory_usage(void);
+	/// Cluster of the rows (cluster1) and of the cols (cluster2) of a block.
+	node* row_cluster(const bct_node*);
+	node* col_cluster(const bct_node*);
 	void output();
 	friend std::ostream& operator<<(std::ostream& os, bctree& gc);
 };
@@ -1,160 +1,537 @@
-/// \file graph_cluster.cpp
-/// \brief Class for storage and manipulation of graphs during H-Matrix build process.
-#include <iostream>
+/// \file graph_cluster.cpp
+/// \brief Class for storage and manipulation of graphs during H-Matrix build process.
+#include <iostream>
 #include <cmath>
+#include <algorithm>
 #include "graph_cluster.h"
 
 using namespace std;
 using namespace Eigen;
 
 typedef vector<unsigned int> Vt;
-
-// removes element from vector
-Vt remove_el(Vt v, int x1,int x2)
-{
-	//cout<<"Currently inside remove_el: "<<x1<<" "<<x2<<endl;
-	Vt dum_v;
-	dum_v = v;
-	dum_v.erase(remove(dum_v.begin(), dum_v.end(), x1), dum_v.end());
-	if (x2>=0)
-		dum_v.erase(remove(dum_v.begin(), dum_v.end(), x2), dum_v.end());
-	//cout<<"Exiting remove_el!"<<endl;
-	return dum_v;
-}
-
+typedef Map<const SparseMatrix<double> > SpMap;
 
 graph_cluster::graph_cluster(void)
 {
 	mat_ptr=NULL;
+	map_matrix(SpMap(0,0,0,NULL,NULL,NULL));
 	n_clusters=0;
 	n_single_clusters=0;
+	leaf_clusters=false;
 }
 
 
 graph_cluster::graph_cluster(SparseMatrix<double>* dum_ptr)
 {
-	mat_ptr = dum_ptr;
+	set_matrix(dum_ptr);
+	n_clusters = 0;
+	n_single_clusters=0;
+	leaf_clusters=false;
+}
+
+graph_cluster::graph_cluster(const SpMap& m)
+{
+	mat_ptr = NULL;
+	map_matrix(m);
 	n_clusters = 0;
 	n_single_clusters=0;
+	leaf_clusters=false;
+}
+
+// the matrix of the graph, owned or mapped, as a map of its compressed arrays
+SpMap graph_cluster::graph(void) const
+{
+	return SpMap(mat_rows, mat_cols, mat_nnz, mat_outer, mat_inner, mat_values);
+}
+
+void graph_cluster::map_matrix(const SpMap& m)
+{
+	mat_rows = m.rows();
+	mat_cols = m.cols();
+	mat_nnz = m.nonZeros();
+	mat_outer = m.outerIndexPtr();
+	mat_inner = m.innerIndexPtr();
+	mat_values = m.valuePtr();
 }
 
 // priority match algorithm for coarsening process
 void graph_cluster::priority_match(Vt gp1,Vt gp2)
 {
 	//cout<<"Priority matching loaded!"<<endl;
-	Vt index_set1,index_set2;
-
-	index_set1 = gp1;
-	index_set2 = gp2;
+	// eligible[v]!=0 marks vertices which are still unmatched and may be paired with the current vertex
+	// every vertex is visited once and every edge is scanned at most twice, so matching costs O(nnz)
+	std::vector<char> eligible(mat_cols,0);
+	for(Vt::iterator itr=gp1.begin();itr!=gp1.end();++itr)
+		eligible[*itr] = 1;
+	for(Vt::iterator itr=gp2.begin();itr!=gp2.end();++itr)
+		eligible[*itr] = 1;
 
 	n_clusters=0;
 
-	while(!index_set1.empty())
+	// first process V1: its vertices may be paired with any unmatched vertex of V1 or V2
+	for(Vt::iterator itr=gp1.begin();itr!=gp1.end();++itr)
 	{
-		unsigned int s = *(index_set1.begin()); // pick a s in V1
-		// union of V1 and V2
-		Vt union_index_set;
-		union_index_set = index_set1;
-		union_index_set.insert(union_index_set.end(),index_set2.begin(),index_set2.end());
+		unsigned int s = *itr; // pick a s in V1
+		if(!eligible[s])
+			continue; // already matched
 
-		unsigned int t;
+		unsigned int t;
 		// find a cluster corresponding to s
-		//cout<<"Removing task started! "<<s<<" "<<t<<endl;
-		if (!this->match(s,union_index_set,&t))
+		eligible[s] = 0;
+		Vt dum_set1;
+		dum_set1.push_back(s);
+		if (this->match(s,eligible,&t))
 		{
-			// means no match found for this s
-			Vt dum_set1;
-			dum_set1.push_back(s);
-			clusters.push_back(dum_set1);
-			index_set1 = remove_el(index_set1,s);
+			// push both indicies to the clusters vector
+			dum_set1.push_back(t);
+			eligible[t] = 0;
 		}
-		else
+		clusters.push_back(dum_set1);
+
+		n_clusters+=1;
+	}
+	// next process the index_set2; all vertices of V1 are matched at this point, so only V2 is eligible
+	for(Vt::iterator itr=gp2.begin();itr!=gp2.end();++itr)
+	{
+		unsigned int s = *itr;
+		if(!eligible[s])
+			continue;
+
+		unsigned int t;
+		eligible[s] = 0;
+		Vt dum_set1;
+		dum_set1.push_back(s);
+		if (this->match(s,eligible,&t))
 		{
-			// push both indicies to the clusters vector
-			Vt dum_set1;
-			dum_set1.push_back(s);
 			dum_set1.push_back(t);
-			clusters.push_back(dum_set1);
-			index_set1 = remove_el(index_set1,s,t);
-			index_set2 = remove_el(index_set2,t);
+			eligible[t] = 0;
 		}
+		clusters.push_back(dum_set1);
 
 		n_clusters+=1;
 	}
-	// next process the index_set2
-	while(!index_set2.empty())
+	this->pair_singletons();
+	if(n_clusters==1)
+		std::sort(clusters.begin()->begin(),clusters.begin()->end());
+
+	this->create_priority_groups();
+}
+
+// parallel priority match: handshake (locally dominant) heavy edge matching
+void graph_cluster::priority_match_parallel(Vt gp1,Vt gp2)
+{
+	int n = mat_cols;
+	SpMap m = graph();
+	// group[v]: 1 == V1, 2 == V2, 0 == not part of this matching
+	std::vector<char> group(n,0);
+	for(Vt::iterator itr=gp1.begin();itr!=gp1.end();++itr)
+		group[*itr] = 1;
+	for(Vt::iterator itr=gp2.begin();itr!=gp2.end();++itr)
+		group[*itr] = 2;
+	std::vector<int> mate(n,-1);
+	std::vector<int> cand(n,-1);
+
+	// pending[v]!=0: 'v' is in the list of vertices whose proposal is (re)computed in the current round
+	std::vector<char> pending(n,0);
+
+	// phase 1 pairs every vertex of V1 with a vertex of V1 or V2, phase 2 pairs the rest of V2 among itself
+	for(int phase=1;phase<=2;phase++)
 	{
-		unsigned int s = *(index_set2.begin()); // pick a s in V1
+		std::vector<int> active;
+		for(int v=0;v<n;v++)
+		{
+			if(group[v]!=0 && mate[v]<0 && (phase==1 || group[v]==2))
+			{
+				active.push_back(v);
+				pending[v] = 1;
+			}
+		}
 
-		unsigned int t;
-		// find a cluster corresponding to s
+		while(!active.empty())
+		{
+			// every active vertex proposes to its heaviest unmatched neighbour; ties go to the larger index, so the result does not depend on the number of threads
+			// the heaviest remaining edge is always a mutual proposal, so every round matches at least one pair
+			#pragma omp parallel for schedule(dynamic,256)
+			for(int l=0;l<int(active.size());l++)
+			{
+				int v = active[l];
+				double dum_max = 0.0;
+				int dum_idx = -1;
+				for(SpMap::InnerIterator it(m,v);it;++it)
+				{
+					int u = it.index();
+					if(u==v || group[u]==0 || mate[u]>=0)
+						continue;
+					// phase 1: at least one end of the edge in V1; phase 2: both ends in V2
+					if(phase==1 && group[v]!=1 && group[u]!=1)
+						continue;
+					if(phase==2 && group[u]!=2)
+						continue;
+					double w = abs(it.value());
+					if(w>dum_max || (w==dum_max && w>0.0 && u>dum_idx))
+					{
+						dum_max = w;
+						dum_idx = u;
+					}
+				}
+				cand[v] = dum_idx;
+			}
+
+			// mutual proposals are matched; a vertex which is not active is matched by its partner
+			#pragma omp parallel for schedule(static)
+			for(int l=0;l<int(active.size());l++)
+			{
+				int v = active[l];
+				int u = cand[v];
+				if(u>=0 && cand[u]==v)
+				{
+					mate[v] = u;
+					if(!pending[u])
+						mate[u] = v;
+				}
+			}
+
+			// only the unmatched vertices which proposed to a vertex matched in this round have to propose again: the proposal of any other vertex is
+			// still unmatched and stays the heaviest, as eligible neighbours only get fewer. Vertices without candidate will never find one.
+			// The proposals to a matched vertex are found among its neighbours, as the graph is symmetric.
+			for(unsigned int l=0;l<active.size();l++)
+				pending[active[l]] = 0;
+			std::vector<int> still_active;
+			for(unsigned int l=0;l<active.size();l++)
+			{
+				int v = active[l];
+				if(mate[v]<0)
+					continue;
+				int pair[2] = {v, mate[v]};
+				for(int e=0;e<2;e++)
+				{
+					for(SpMap::InnerIterator it(m,pair[e]);it;++it)
+					{
+						int w = it.index();
+						if(mate[w]<0 && cand[w]==pair[e] && !pending[w])
+						{
+							still_active.push_back(w);
+							pending[w] = 1;
+						}
+					}
+				}
+			}
+			active.swap(still_active);
+		}
+	}
 
-		if (!this->match(s,index_set2,&t))
+	// clusters in the same order as the serial priority match: V1 first, then V2
+	n_clusters=0;
+	std::vector<char> done(n,0);
+	for(int g=0;g<2;g++)
+	{
+		Vt& gp = (g==0) ? gp1 : gp2;
+		for(Vt::iterator itr=gp.begin();itr!=gp.end();++itr)
 		{
-			// means no match found for this s
+			unsigned int s = *itr;
+			if(done[s])
+				continue;
 			Vt dum_set1;
 			dum_set1.push_back(s);
+			done[s] = 1;
+			if(mate[s]>=0)
+			{
+				dum_set1.push_back(mate[s]);
+				done[mate[s]] = 1;
+			}
 			clusters.push_back(dum_set1);
-			index_set2 = remove_el(index_set2,s);
+			n_clusters+=1;
 		}
-		else
+	}
+	this->pair_singletons();
+	if(n_clusters==1)
+		std::sort(clusters.begin()->begin(),clusters.begin()->end());
+
+	this->create_priority_groups();
+}
+
+// k-way aggregation: clusters of up to k vertices, grown along the heaviest connections
+void graph_cluster::aggregate_match(Vt gp1,Vt gp2,int k)
+{
+	int n = mat_cols;
+	SpMap m = graph();
+	std::vector<char> eligible(n,0);
+	for(Vt::iterator itr=gp1.begin();itr!=gp1.end();++itr)
+		eligible[*itr] = 1;
+	for(Vt::iterator itr=gp2.begin();itr!=gp2.end();++itr)
+		eligible[*itr] = 1;
+	// conn[u]: total edge weight between vertex 'u' and the cluster being grown; 'touched' lists the vertices with conn[u]!=0
+	std::vector<double> conn(n,0.0);
+	std::vector<unsigned int> touched;
+
+	n_clusters=0;
+	for(int g=0;g<2;g++)
+	{
+		Vt& gp = (g==0) ? gp1 : gp2;
+		for(Vt::iterator itr=gp.begin();itr!=gp.end();++itr)
 		{
-			// push both indicies to the clusters vector
+			unsigned int s = *itr;
+			if(!eligible[s])
+				continue;
+			eligible[s] = 0;
 			Vt dum_set1;
 			dum_set1.push_back(s);
-			dum_set1.push_back(t);
+			unsigned int last = s;
+			while(int(dum_set1.size())<k)
+			{
+				// add the edges of the last member to the connection weights
+				for(SpMap::InnerIterator it(m,last);it;++it)
+				{
+					unsigned int u = it.index();
+					if(!eligible[u] || u==last)
+						continue;
+					if(conn[u]==0.0)
+						touched.push_back(u);
+					conn[u] += abs(it.value());
+				}
+				// pick the unaggregated vertex with the strongest connection to the cluster
+				double dum_max = 0.0;
+				for(Vt::iterator t=touched.begin();t!=touched.end();++t)
+				{
+					if(eligible[*t] && conn[*t]>dum_max)
+					{
+						dum_max = conn[*t];
+						last = *t;
+					}
+				}
+				if(dum_max==0.0)
+					break;
+				eligible[last] = 0;
+				dum_set1.push_back(last);
+			}
+			for(Vt::iterator t=touched.begin();t!=touched.end();++t)
+				conn[*t] = 0.0;
+			touched.clear();
 			clusters.push_back(dum_set1);
-			index_set2 = remove_el(index_set2,s,t);
+			n_clusters+=1;
 		}
+	}
+	this->pair_singletons();
+	if(n_clusters==1)
+		std::sort(clusters.begin()->begin(),clusters.begin()->end());
+
+	this->create_priority_groups();
+}
+
+// aggregation of the finest graph into leaf clusters
+void graph_cluster::leaf_aggregate(int leaf_size)
+{
+	int n = mat_cols;
+	SpMap m = graph();
+	std::vector<char> eligible(n,1);
+	Vt single; // vertices without unaggregated neighbours
 
+	n_clusters=0;
+	for(int s=0;s<n;s++)
+	{
+		if(!eligible[s])
+			continue;
+		eligible[s] = 0;
+		Vt dum_set1;
+		dum_set1.push_back(s);
+		// breadth first search from 's'; the members of the cluster serve as the queue
+		for(unsigned int l=0;l<dum_set1.size() && int(dum_set1.size())<leaf_size;l++)
+		{
+			for(SpMap::InnerIterator it(m,dum_set1[l]);it && int(dum_set1.size())<leaf_size;++it)
+			{
+				if(eligible[it.index()] && it.value()!=0.0)
+				{
+					eligible[it.index()] = 0;
+					dum_set1.push_back(it.index());
+				}
+			}
+		}
+		if(dum_set1.size()==1)
+			single.push_back(s);
+		else
+		{
+			clusters.push_back(dum_set1);
+			n_clusters+=1;
+		}
+	}
+	// vertices which could not be grown into a cluster are packed into leaf clusters of their own
+	for(unsigned int l=0;l<single.size();l+=leaf_size)
+	{
+		Vt dum_set1(single.begin()+l,single.begin()+std::min<unsigned int>(l+leaf_size,single.size()));
+		clusters.push_back(dum_set1);
 		n_clusters+=1;
 	}
+	leaf_clusters = true;
+
+	this->create_priority_groups();
+}
+
+// parallel k-way aggregation: composition of parallel pairwise matchings
+void graph_cluster::aggregate_match_parallel(Vt gp1,Vt gp2,int k)
+{
+	int levels = 0;
+	while((2<<levels)<=k)
+		levels++;
+	this->match_levels(gp1,gp2,levels);
 	if(n_clusters==1)
 		std::sort(clusters.begin()->begin(),clusters.begin()->end());
 
 	this->create_priority_groups();
 }
 
-// HEAVY EDGE MATCHING ALGORITHM
+// parallel aggregation of the finest graph into leaf clusters
+void graph_cluster::leaf_aggregate_parallel(int leaf_size)
+{
+	int levels = 0;
+	while((2<<levels)<=leaf_size)
+		levels++;
+	Vt gp1(mat_cols),gp2;
+	for(int v=0;v<mat_cols;v++)
+		gp1[v] = v;
+	this->match_levels(gp1,gp2,levels);
+	leaf_clusters = true;
+
+	this->create_priority_groups();
+}
 
-int graph_cluster::match(unsigned int s, Vt idx_set, unsigned int* t)
+// 'levels' steps of parallel pairwise matching on coarser and coarser temporary graphs, composed into the clusters of this graph
+void graph_cluster::match_levels(Vt gp1,Vt gp2,int levels)
 {
-	// if match is not found this function returns negative values
-	unsigned int col = s;
-	double dum_max=0.0;
-	unsigned int dum_idx;
-	int dum=1;
-	for(SparseMatrix<double>::InnerIterator it(*mat_ptr,col);it;++it)
+	// comp[c]: the vertices of this graph in vertex 'c' of the graph 'g' of the current level
+	std::vector<Vt> comp;
+	if(levels<1)
 	{
-		if(find(idx_set.begin(),idx_set.end(),it.index())!=idx_set.end())
+		for(int g=0;g<2;g++)
 		{
-			// checks if the current index search in graph is in the input index set
-
-			if(it.index()==s)
+			Vt& gp = (g==0) ? gp1 : gp2;
+			for(Vt::iterator itr=gp.begin();itr!=gp.end();++itr)
+				comp.push_back(Vt(1,*itr));
+		}
+	}
+	else
+	{
+		graph_cluster g(graph());
+		g.priority_match_parallel(gp1,gp2);
+		comp = g.clusters;
+		SparseMatrix<double> coarse[2]; // matrices of the last two levels
+		for(int l=1;l<levels && comp.size()>1;l++)
+		{
+			SparseMatrix<double>& dum_mat = coarse[l%2];
+			g.convert_to_coarser_graph(dum_mat);
+			graph_cluster h(&dum_mat);
+			h.priority_match_parallel(g.groups.group1,g.groups.group2);
+			std::vector<Vt> dum_comp(h.clusters.size());
+			for(unsigned int c=0;c<h.clusters.size();c++)
 			{
-				// do nothing
+				for(Vt::iterator itr=h.clusters[c].begin();itr!=h.clusters[c].end();++itr)
+					dum_comp[c].insert(dum_comp[c].end(),comp[*itr].begin(),comp[*itr].end());
 			}
-			else
+			comp.swap(dum_comp);
+			g = h;
+		}
+	}
+	clusters.insert(clusters.end(),comp.begin(),comp.end());
+	n_clusters = clusters.size();
+}
+
+bool graph_cluster::has_leaf_clusters(void)
+{
+	return leaf_clusters;
+}
+
+// two-hop matching and forced pairing of singleton clusters
+void graph_cluster::pair_singletons(void)
+{
+	std::vector<unsigned int> single;
+	for(unsigned int c=0;c<clusters.size();c++)
+	{
+		if(clusters[c].size()==1)
+			single.push_back(c);
+	}
+	if(single.size()<2)
+		return;
+
+	// singletons with the same heaviest neighbour are paired; waiting[h] is a singleton whose partner is still missing
+	std::vector<int> waiting(mat_cols,-1);
+	SpMap m = graph();
+	std::vector<char> merged(clusters.size(),0);
+	for(Vt::iterator itr=single.begin();itr!=single.end();++itr)
+	{
+		unsigned int s = clusters[*itr].at(0);
+		double dum_max = 0.0;
+		int h = -1;
+		for(SpMap::InnerIterator it(m,s);it;++it)
+		{
+			if(it.index()!=int(s) && abs(it.value())>dum_max)
 			{
-				if(abs(it.value())>=dum_max)
-				{
-					dum_idx = it.index();
-					dum_max = abs(it.value());
-					//std::cout<<"dum_max: "<<dum_max<<std::endl;
-					//std::cout<<"dum_idx: "<<dum_idx<<std::endl;
-				}
+				dum_max = abs(it.value());
+				h = it.index();
 			}
 		}
+		if(h<0)
+			continue; // isolated vertex
+		if(waiting[h]<0)
+			waiting[h] = *itr;
+		else
+		{
+			clusters[waiting[h]].push_back(s);
+			merged[*itr] = 1;
+			waiting[h] = -1;
+		}
+	}
+	// the singletons left are paired in order, even if they are not connected
+	int last = -1;
+	for(Vt::iterator itr=single.begin();itr!=single.end();++itr)
+	{
+		if(merged[*itr] || clusters[*itr].size()!=1)
+			continue;
+		if(last<0)
+			last = *itr;
 		else
 		{
-			// do nothing because the current index is not in the input index set, which means that pairing is not possible
+			clusters[last].push_back(clusters[*itr].at(0));
+			merged[*itr] = 1;
+			last = -1;
 		}
 	}
-
-    if(dum_max==0.0)
-        dum=0;
-
-    *t = dum_idx;
+
+	std::vector<Vt> dum_clusters;
+	for(unsigned int c=0;c<clusters.size();c++)
+	{
+		if(!merged[c])
+			dum_clusters.push_back(clusters[c]);
+	}
+	clusters.swap(dum_clusters);
+	n_clusters = clusters.size();
+}
+
+// HEAVY EDGE MATCHING ALGORITHM
+
+int graph_cluster::match(unsigned int s, std::vector<char>& eligible, unsigned int* t)
+{
+	// if match is not found this function returns 0
+	unsigned int col = s;
+	SpMap m = graph();
+	double dum_max=0.0;
+	unsigned int dum_idx=s;
+	int dum=1;
+	for(SpMap::InnerIterator it(m,col);it;++it)
+	{
+		// only vertices which are still unmatched can be paired with s
+		if(eligible[it.index()] && it.index()!=int(s))
+		{
+			if(abs(it.value())>=dum_max)
+			{
+				dum_idx = it.index();
+				dum_max = abs(it.value());
+			}
+		}
+	}
+
+    if(dum_max==0.0)
+        dum=0;
+
+    *t = dum_idx;
 
 	return dum;
 
@@ -223,99 +600,43 @@ void graph_cluster::create_priority_groups(void)
 
 void graph_cluster::convert_to_coarser_graph(Eigen::SparseMatrix<double>& dum_mat)
 {
-	// initialize a sparse matrix which holds the new coarser graph
-	SparseMatrix<double> new_graph(n_clusters,n_clusters);
-
-	if(!clusters.empty())
-	{
-		//iterate over each cluster to fill the sparse matrix
-		for(unsigned int i=0;i<n_clusters;i++)
-		{
-			//cout<<"i: "<<i<<endl;
-			Vt dum_set_col = clusters.at(i);
-			for(unsigned int j=0;j<n_clusters;j++)
-			{
-				//cout<<"  it= "<<j<<endl;
-				if(j==i)
-				{
-					// diagonal element
-					new_graph.coeffRef(j,i)=1;
-				}
-				else
-				{
-					Vt dum_set_row = clusters.at(j);
-					double dum_coeff =0;
-					for(Vt::iterator it_col = dum_set_col.begin();it_col!=dum_set_col.end();++it_col)
-					{
-						for(Vt::iterator it_row = dum_set_row.begin();it_row!=dum_set_row.end();++it_row)
-						{
-							dum_coeff += mat_ptr->coeff(*it_row,*it_col);
-						}
-					}
-					//cout<<"DB: dum_coeff= "<<dum_coeff<<endl;
-					new_graph.coeffRef(j,i)=dum_coeff;
-				}
-			}
-		}
-		//cout<<"Operation success"<<endl;
-		//cout<<Eigen::MatrixXd(new_graph)<<endl;
-	}
-	else
-	{
-		cout<<"Error in convert_to_coarser_graph function! Empty clusters!"<<endl;
-		return;
-
-	}
-	dum_mat = new_graph;
+	convert_to_coarser_graph(dum_mat, clusters);
 }
 
 //function overloading for convert to coarser graph
-void graph_cluster::convert_to_coarser_graph(Eigen::SparseMatrix<double>& dum_mat,std::vector<std::vector<unsigned int> > clusters_v)
+void graph_cluster::convert_to_coarser_graph(Eigen::SparseMatrix<double>& dum_mat,const std::vector<std::vector<unsigned int> >& clusters_v)
 {
-	// initialize a sparse matrix which holds the new coarser graph
-	SparseMatrix<double> new_graph(clusters_v.size(),clusters_v.size());
-
-	if(!clusters_v.empty())
-	{
-		//iterate over each cluster to fill the sparse matrix
-		for(unsigned int i=0;i<clusters_v.size();i++)
-		{
-			//cout<<"i: "<<i<<endl;
-			Vt dum_set_col = clusters_v.at(i);
-			for(unsigned int j=0;j<clusters_v.size();j++)
-			{
-				//cout<<"  j: "<<j<<endl;
-				if(j==i)
-				{
-					// diagonal element
-					new_graph.coeffRef(j,i)=1;
-				}
-				else
-				{
-					Vt dum_set_row = clusters_v.at(j);
-					double dum_coeff =0;
-					for(Vt::iterator it_col = dum_set_col.begin();it_col!=dum_set_col.end();++it_col)
-					{
-						for(Vt::iterator it_row = dum_set_row.begin();it_row!=dum_set_row.end();++it_row)
-						{
-							dum_coeff += mat_ptr->coeff(*it_row,*it_col);
-						}
-					}
-					//cout<<"DB: dum_coeff= "<<dum_coeff<<endl;
-					new_graph.coeffRef(j,i)=dum_coeff;
-				}
-			}
-		}
-		//cout<<"Operation success"<<endl;
-		//cout<<Eigen::MatrixXd(new_graph)<<endl;
-	}
-	else
+	if(clusters_v.empty())
 	{
 		cout<<"Error in convert_to_coarser_graph function! Empty clusters!"<<endl;
 		return;
+	}
 
+	// aggregation operator: P(v,c) = 1 if vertex 'v' of this graph belongs to cluster 'c'
+	// the edge weight between clusters 'i' and 'j' is the sum over all member pairs, i.e. the coarse graph is P^T*A*P
+	SparseMatrix<double> P(mat_rows,clusters_v.size());
+	std::vector<Triplet<double> > entries;
+	entries.reserve(mat_rows);
+	for(unsigned int i=0;i<clusters_v.size();i++)
+	{
+		for(Vt::const_iterator itr=clusters_v[i].begin();itr!=clusters_v[i].end();++itr)
+			entries.push_back(Triplet<double>(*itr,i,1.0));
 	}
-	dum_mat = new_graph;
+	P.setFromTriplets(entries.begin(),entries.end());
+
+	SparseMatrix<double> new_graph = SparseMatrix<double>(P.transpose()*graph())*P;
+
+	// only real edges are stored; the diagonal is replaced by 1
+	new_graph.prune(is_edge);
+	SparseMatrix<double> identity(clusters_v.size(),clusters_v.size());
+	identity.setIdentity();
+	dum_mat = new_graph + identity;
+}
+
+// keeps the off-diagonal nonzeros when pruning the coarse graph
+bool is_edge(const int& row, const int& col, const double& value)
+{
+	return row!=col && value!=0.0;
 }
 
 // sets matrix pointer for a graph cluster object
@@ -324,9 +645,16 @@ void graph_cluster::set_matrix(Eigen::SparseMatrix<double>* dum_ptr)
 	//cout<<"DB: pointer updated successfully"<<endl;
 	//cout<<"DB1------>before->\n"<<Eigen::MatrixXd(*dum_ptr)<<endl;
 	mat_ptr = dum_ptr;
+	mat_ptr->makeCompressed();
+	map_matrix(SpMap(mat_ptr->rows(), mat_ptr->cols(), mat_ptr->nonZeros(), mat_ptr->outerIndexPtr(), mat_ptr->innerIndexPtr(), mat_ptr->valuePtr()));
 	//cout<<"DB1------>after->\n"<<Eigen::MatrixXd(*mat_ptr)<<endl;
 }
 
+SparseMatrix<double>* graph_cluster::get_matrix(void)
+{
+	return mat_ptr;
+}
+
 // gets number of cluster of graph_cluster object
 
 int graph_cluster::get_n_clusters(void)
@@ -360,7 +688,7 @@ void graph_cluster::set_clusters(std::vector<std::vector<unsigned int> >& x)
 //edge weight of two given verticies
 double graph_cluster::edge_weight(int i1, int i2)
 {
-	return mat_ptr->coeff(i1,i2);
+	return graph().coeff(i1,i2);
 }
 
 // print overloading
@@ -369,7 +697,7 @@ ostream& operator<<(ostream& os, graph_cluster& gc)
 {
 	os<<"-----------------------------------------------------"<<"\n";
 	os<<"Matrix_Graph:\n";
-	os<<Eigen::MatrixXd(*(gc.mat_ptr))<<"\n";
+	os<<Eigen::MatrixXd(gc.graph())<<"\n";
 	os<<"Clusters "<<"(n = "<<gc.n_clusters<<"): ";
 	if(!gc.clusters.empty())
 	{
@@ -405,4 +733,4 @@ ostream& operator<<(ostream& os, graph_cluster& gc)
 	}
 	os<<"-----------------------------------------------------"<<"\n";
 	return os;
-}
+}
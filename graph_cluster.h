@@ -24,27 +24,62 @@ struct priority_groups
 class graph_cluster
 {
 private:
-	Eigen::SparseMatrix<double>* mat_ptr;
+	Eigen::SparseMatrix<double>* mat_ptr; // NULL if the graph was created from a map
+	// arrays of the compressed matrix of the graph; the methods read the graph through 'graph'
+	int mat_rows, mat_cols, mat_nnz;
+	const int* mat_outer;
+	const int* mat_inner;
+	const double* mat_values;
+	Eigen::Map<const Eigen::SparseMatrix<double> > graph(void) const;
+	void map_matrix(const Eigen::Map<const Eigen::SparseMatrix<double> >&);
+	/// Clusters of at most 2^levels vertices for the parallel aggregation: 'levels' steps of 'priority_match_parallel' on coarser and coarser temporary graphs, composed into clusters of this graph.
+	void match_levels(std::vector<unsigned int>, std::vector<unsigned int>, int levels);
 	std::vector<std::vector<unsigned int> > clusters;
 	int n_clusters;
 	int n_single_clusters;
+	bool leaf_clusters; // true if the clusters are the leaf clusters from 'leaf_aggregate'
 	priority_groups groups;
 public:
     /// Default constructor for 'graph_cluster' class; creates an empty object.
 	graph_cluster(void);
-	/// Custom constructor for 'graph_cluster' class.
+	/// Custom constructor for 'graph_cluster' class. The matrix is compressed if it is not.
 	graph_cluster(Eigen::SparseMatrix<double>* dum_ptr);
+	/// Graph of a mapped matrix (e.g. 'binary_matrix::matrix'), which is read in place and must stay valid while the graph uses it; 'get_matrix' returns NULL.
+	graph_cluster(const Eigen::Map<const Eigen::SparseMatrix<double> >&);
 	/// Method for executing the Priority Match algorithm (source: Fang Yang journal). This method uses 'match' and 'create_priority_groups' methods of a graph_cluster object.
 	void priority_match(std::vector<unsigned int>, std::vector<unsigned int>);
-	/// Method finds the maximum edge adjacent to the input index ('s'). If no match is found (e.g. zero weight), then the function returns negative index.
-	int match(unsigned int s, std::vector<unsigned int> idx_set, unsigned int*);
+	/// Parallel version of 'priority_match' based on handshake (locally dominant) heavy edge matching: in every round each unmatched vertex proposes to its heaviest eligible neighbour, and mutual proposals are matched.
+	/// Vertices of group1 are matched first (with vertices of both groups), the rest of group2 among itself afterwards. The clusters are deterministic for any number of threads.
+	void priority_match_parallel(std::vector<unsigned int>, std::vector<unsigned int>);
+	/// k-way aggregation for coarsening with fewer levels: every unaggregated vertex (group1 first, then group2) starts a cluster, which grows by the unaggregated vertex with the largest total edge weight to the cluster until it holds 'k' vertices or has no such neighbour left.
+	void aggregate_match(std::vector<unsigned int>, std::vector<unsigned int>, int k);
+	/// Parallel version of 'aggregate_match': log2(k) steps of the handshake matching are composed into clusters of at most 'k' vertices ('match_levels').
+	/// The clusters are deterministic for any number of threads.
+	void aggregate_match_parallel(std::vector<unsigned int>, std::vector<unsigned int>, int k);
+	/// Aggregation of the finest graph directly into leaf clusters of at most 'leaf_size' vertices, grown by breadth first search from the unaggregated vertex with the smallest index.
+	/// Used instead of matching for the first coarsening step, so that no graphs or tree levels below the leaf size are built.
+	void leaf_aggregate(int leaf_size);
+	/// Parallel version of 'leaf_aggregate': log2(leaf_size) steps of the handshake matching are composed into leaf clusters ('match_levels') instead of a breadth first search.
+	/// The clusters are deterministic for any number of threads.
+	void leaf_aggregate_parallel(int leaf_size);
+	/// Returns true if the clusters of this graph are leaf clusters ('leaf_aggregate'); these become the leaves of the cluster tree.
+	bool has_leaf_clusters(void);
+	/// Pairs the singleton clusters left by the matching or aggregation: first singletons whose heaviest neighbour is the same vertex (two-hop matching), then the remaining ones in order (forced pairing).
+	/// Afterwards at most one singleton is left, so every coarsening step at least halves the number of vertices, also for graphs with isolated or star-like vertices.
+	void pair_singletons(void);
+	/// Method finds the maximum edge adjacent to the input index ('s') among the vertices flagged in 'eligible'. If no match is found (e.g. zero weight), then the function returns 0.
+	int match(unsigned int s, std::vector<char>& eligible, unsigned int*);
 	/// Function overloading for directly printing the graph_cluster object to the console.
 	friend std::ostream& operator<<(std::ostream& os, graph_cluster& gc);
 	/// Method to convert the current graph to a coarser graph using the clusters obtained using HEM algorithm.
+	/// The coarse graph is assembled as P^T*A*P, where P is the cluster-to-vertex aggregation operator; only real edges and a unit diagonal are stored.
 	void convert_to_coarser_graph(Eigen::SparseMatrix<double>&);
-	void convert_to_coarser_graph(Eigen::SparseMatrix<double>&,std::vector<std::vector<int unsigned> >);
-	/// Helper function to assign matrix to the graph_cluster object.
+	/// Same as above, using the clusters given as input instead of the clusters of the object.
+	void convert_to_coarser_graph(Eigen::SparseMatrix<double>&,const std::vector<std::vector<int unsigned> >&);
+	/// Helper function to assign matrix to the graph_cluster object. The matrix is compressed if it is not.
 	void set_matrix(Eigen::SparseMatrix<double>*);
+	/// Returns the matrix of the graph (NULL for the graph of a map); the graph_cluster object does not own it.
+	Eigen::SparseMatrix<double>* get_matrix(void);
 	int get_n_clusters(void);
 	std::vector<unsigned int> get_cluster(unsigned int);
 	/// Method to divide clusters into priority groups, with singleton sets with higher priority.
@@ -55,8 +90,7 @@ public:
 	double edge_weight(int, int);
 };
 
-// function to remove element from vectors during priority matching
-/// Helper function to remove element from the input vector 'v' located at 'x1' and 'x2'.
-std::vector<unsigned int> remove_el(std::vector<unsigned int> v, int x1, int x2=-100);
+/// Helper for pruning the coarse graph: keeps off-diagonal nonzeros only.
+bool is_edge(const int& row, const int& col, const double& value);
 
 #endif
@@ -2,308 +2,1703 @@
 /// \brief Class for storage and manipulation of Hierarchical Matrices.
 
 #include "h_mat.h"
-#include <queue>
+#include "matrix_io.h"
+#include "hmat_file.h"
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
 #include <algorithm>
+#include <random>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 //deafult constructor
 hmat::hmat()
 {
-	supermat* s = new supermat;
-	root =s;
+	eps = 0.0;
 }
 
 hmat::hmat(bctree& bct, Eigen::SparseMatrix<double>* mat, int r=10)
 {
-	root = create_hmat(bct,mat,r);
+	eps = 0.0;
+	create_hmat(bct,mat,r);
+}
+
+hmat::hmat(bctree& bct, Eigen::SparseMatrix<double>* mat, int r, std::vector<unsigned int>& v, double tol)
+{
+	idx_set = v;
+	eps = tol;
+	create_hmat(bct,mat,r);
 }
 
 supermat* hmat::create_hmat(bctree& bct, Eigen::SparseMatrix<double>* mat, int r)
 {
-	// a queue is needed for traversal of block cluster tree
-	std::queue<bct_node*> bct_nodes;
-	bct_nodes.push(bct.get_root());
-	bct_node* current_node = new bct_node;
-
-	// this is the supermat pointer which will be returned to the calling function
-	supermat* dum_root = new supermat;
-
-	dum_root->type = bct.get_root()->type;
-	dum_root->rows = (bct.get_root()->cluster1->data).size();
-	dum_root->cols = (bct.get_root()->cluster2->data).size();
-
-	// a queue is needed for traversal of set of H-Matrices
-	std::queue<supermat*> hmat_nodes;
-	hmat_nodes.push(dum_root);
-	supermat* current_block = new supermat;
-	// this stores the current matrix block information
-	//Eigen::SparseMatrix<double>* current_mat = mat;
-	while(!hmat_nodes.empty())
-	{
-		current_node = bct_nodes.front();
-		bct_nodes.pop();
-
-		current_block = hmat_nodes.front();
-		hmat_nodes.pop();
-
-        //std::cout<<"DB: "<<current_node->type<<","<<current_node->cluster1->data.at(0)<<std::endl;
-
-		if(current_node->type==1)
-		{
-			// this is R-k Leaf
-			unsigned int dum_el =0;
-			int start_row = current_node->cluster1->data.at(dum_el);
-			int start_col = current_node->cluster2->data.at(dum_el);
-			int n_rows = current_node->cluster1->data.size();
-			int n_cols = current_node->cluster2->data.size();
-			current_block->f = NULL;
-			current_block->s.clear();
-			current_block->rows = n_rows;
-			current_block->cols = n_cols;
-			current_block->type = 1;
-			Eigen::MatrixXd dum_mat = Eigen::MatrixXd(mat->block(start_row,start_col,n_rows,n_cols));
-			rkmat* dum_rk = new rkmat;
-			current_block->r= dum_rk;
-			CA_partial_pivot(dum_mat, current_block->r, r);
-			/////////////////////////////////////////////////////////////////////////////////////////////////
-			//debug rk-block
-			//std::cout<<"start_row, start_col, n_rows, n_cols: "<<start_row<<", "<<start_col<<", "<<n_rows<<", "<<n_cols<<std::endl;
-			//std::cout<<"block being approximated:"<<std::endl;
-			//std::cout<<dum_mat<<std::endl;
-			//std::cout<<"rk approximation: "<<std::endl;
-			//std::cout<<"a-vec"<<std::endl;
-			//for(std::vector<Eigen::VectorXd >::iterator itr=current_block->r->a.begin();itr!=current_block->r->a.end();++itr)
-            //{
-           //     std::cout<<*itr<<std::endl;
-            //}
-           // std::cout<<"b-vec"<<std::endl;
-			//for(std::vector<Eigen::VectorXd >::iterator itr=current_block->r->b.begin();itr!=current_block->r->b.end();++itr)
-           // {
-           //     std::cout<<*itr<<std::endl;
-           // }
-            // debug ends
-            ///////////////////////////////////////////////////////////////////////////////////////////////////////////
-		}
-		else if(current_node->type==2)
-		{
-			// this is a dense node
-			// for this case we need to partition the matrix and store the block in full matrix pointer 'f'
-			unsigned int dum_el =0;
-			int start_row = current_node->cluster1->data.at(dum_el);
-			int start_col = current_node->cluster2->data.at(dum_el);
-			int n_rows = current_node->cluster1->data.size();
-			int n_cols = current_node->cluster2->data.size();
-			//std::cout<<"start_row, start_col, n_rows, n_cols: "<<start_row<<","<<start_col<<","<<n_rows<<","<<n_cols<<std::endl;
-			fullmat* dum_f = new fullmat;
-			Eigen::SparseMatrix<double>* dum_mat = new Eigen::SparseMatrix<double>;
-			*dum_mat = mat->block(start_row,start_col,n_rows,n_cols);
-            dum_f->m = dum_mat;
-			current_block->f= dum_f;
-			current_block->s.clear();
-			current_block->r=NULL;
-			current_block->type=2;
-			current_block->rows = n_rows;
-			current_block->cols = n_cols;
-		}
-		else if(current_node->type==3)
-		{
-			// this is supermatrix node
-			std::vector<bct_node*> child_current_node;
-            child_current_node.clear();
-
-			if(current_node->left_left!=NULL)
-            {
-				child_current_node.push_back(current_node->left_left);
-                //std::cout<<"DB: (type) "<<current_node->left_left->type<<std::endl;
-            }
-
-			if(current_node->left!=NULL)
-            {
-				child_current_node.push_back(current_node->left);
-                //std::cout<<"DB: (type) "<<current_node->left->type<<std::endl;
-            }
-
-			if(current_node->right!=NULL)
-            {
-				child_current_node.push_back(current_node->right);
-				//std::cout<<"DB: (type) "<<current_node->right->type<<std::endl;
-            }
-
-			if(current_node->right_right!=NULL)
-            {
-                child_current_node.push_back(current_node->right_right);
-                // debug
-
-                // BUG/Issue: the current node right_right node type value keeps changing randomly
-                // No possible error detected as of yet.
-                // To make the code work, run the program multiple times; works on a random iteration.
-
-                //std::cout<<"Debug output begins..."<<std::endl;
-                std::vector<unsigned int> current_data = current_node->cluster1->data;
-                std::vector<unsigned int> current_data1 = current_node->cluster2->data;
-                //std::cout<<" C1: <- ";
-                //for(std::vector<unsigned int>::iterator itr = current_data.begin(); itr!= current_data.end(); ++ itr)
-                //{
-               //     std::cout<<" "<<*itr<<" ";
-               // }
-               // std::cout<<"-> ";
-               // std::cout<<" C2: <- ";
-               // for(std::vector<unsigned int>::iterator itr = current_data1.begin(); itr!= current_data1.end(); ++ itr)
-               // {
-                //    std::cout<<" "<<*itr<<" ";
-               // }
-               // std::cout<<"-> ";
-               // std::cout<<"DB: (type) "<<current_node->right_right->type<<std::endl;
-               // std::cout<<"Debug output ends..."<<std::endl;
-            }
-
-
-			current_block->r=NULL;
-			current_block->f=NULL;
-			current_block->type=3;
-			// create supermatrix nodes corresponding to the non-NULL children of current node of bct
-			for(std::vector<bct_node*>::iterator itr=child_current_node.begin(); itr!= child_current_node.end(); ++itr)
+	// row compressed copy of the matrix: the cross approximation reads single rows and columns of the rk blocks
+	mat->makeCompressed();
+	Eigen::SparseMatrix<double,Eigen::RowMajor> mat_csr(*mat);
+
+	// the H-Matrix has the same structure as the block cluster tree: one block per node, in the same order
+	blocks.resize(bct.n_nodes());
+	// the leaf lists of 'apply_parallel' and 'recompress' point into the old blocks
+	leaves.clear();
+	leaf_part.clear();
+	rk_pool.clear();
+	full_pool.clear();
+	sparse_pool.clear();
+	file.close(); // leaves of a loaded H-Matrix
+	std::vector<supermat*> leaf_tasks; // leaves which still have to be filled
+	for(unsigned int i=0;i<bct.n_nodes();i++)
+	{
+		bct_node* current_node = bct.get_node(i);
+		supermat* current_block = &blocks[i];
+		current_block->type = current_node->type;
+		current_block->rows = bct.row_cluster(current_node)->size();
+		current_block->cols = bct.col_cluster(current_node)->size();
+		current_block->start_row = bct.row_cluster(current_node)->begin;
+		current_block->start_col = bct.col_cluster(current_node)->begin;
+		current_block->r = NULL;
+		current_block->f = NULL;
+		current_block->first_child = current_node->first_child;
+		current_block->n_child = current_node->n_child;
+
+		if(current_node->type==1 || current_node->type==2)
+		{
+			// this is a leaf: R-k or dense
+			// the block is only recorded here; all leaves are extracted/compressed once the structure is complete
+			// the leaf objects come from the pools, so they are created here and only filled in parallel
+			if(current_node->type==1)
+				current_block->r = rk_pool.create();
+			else
 			{
-				supermat* new_sp = new supermat;
-				new_sp->type = (*itr)->type;
-				new_sp->rows = (*itr)->cluster1->data.size();
-				new_sp->cols = (*itr)->cluster2->data.size();
-				current_block->s.push_back(new_sp);
-				bct_nodes.push(*itr);
-				hmat_nodes.push(new_sp);
+				current_block->f = full_pool.create();
+				current_block->f->m = sparse_pool.create();
 			}
+			leaf_tasks.push_back(current_block);
 		}
-		else
+		else if(current_node->type!=3)
 		{
 			std::cout<<"Error in create_hmat: unknown type of matrix block!"<<std::endl;
 			break;
 		}
 	}
-    delete current_block,current_node;
 
-	return dum_root;
+	// the dense blocks are copied from the matrix and the rk blocks without entries are found in one pass over the matrix
+	extract_leaves(leaf_tasks, mat);
+	unsigned int n_tasks = 0;
+	for(unsigned int l=0;l<leaf_tasks.size();l++)
+	{
+		if(leaf_tasks[l]->type==1)
+			leaf_tasks[n_tasks++] = leaf_tasks[l];
+	}
+	leaf_tasks.resize(n_tasks);
+
+	// the rk leaves are independent tasks; their sizes differ by orders of magnitude, so the largest blocks are started first
+	// and the remaining ones are handed out dynamically to the threads that become idle
+	std::stable_sort(leaf_tasks.begin(),leaf_tasks.end(),task_sort);
+#ifdef HMAT_USE_RSVD
+	// the randomized SVD compresses all rk leaves together, in batched sparse products
+	std::vector<sparse_block> rsvd_blocks(leaf_tasks.size());
+	std::vector<rkmat*> rsvd_rk(leaf_tasks.size());
+	for(unsigned int l=0;l<leaf_tasks.size();l++)
+	{
+		sparse_block& blk = rsvd_blocks[l];
+		blk.csc = mat;
+		blk.csr = &mat_csr;
+		blk.start_row = leaf_tasks[l]->start_row;
+		blk.start_col = leaf_tasks[l]->start_col;
+		blk.n_rows = leaf_tasks[l]->rows;
+		blk.n_cols = leaf_tasks[l]->cols;
+		rsvd_rk[l] = leaf_tasks[l]->r;
+	}
+	RSVD(rsvd_blocks, rsvd_rk, r, eps);
+#else
+	#pragma omp parallel for schedule(dynamic,1)
+	for(int l=0;l<int(leaf_tasks.size());l++)
+		build_leaf(leaf_tasks[l], mat, &mat_csr, r);
+#endif
+
+	return &blocks[0];
+}
+
+// fills an rk leaf of the H-Matrix by compression of its block
+void hmat::build_leaf(supermat* current_block, Eigen::SparseMatrix<double>* mat, Eigen::SparseMatrix<double,Eigen::RowMajor>* mat_csr, int r)
+{
+	int start_row = current_block->start_row;
+	int start_col = current_block->start_col;
+	int n_rows = current_block->rows;
+	int n_cols = current_block->cols;
+	if(current_block->type==1)
+	{
+		// this is R-k Leaf
+		sparse_block blk;
+		blk.csc = mat;
+		blk.csr = mat_csr;
+		blk.start_row = start_row;
+		blk.start_col = start_col;
+		blk.n_rows = n_rows;
+		blk.n_cols = n_cols;
+		CA_partial_pivot(blk, current_block->r, r, eps);
+		/////////////////////////////////////////////////////////////////////////////////////////////////
+		//debug rk-block
+		//std::cout<<"start_row, start_col, n_rows, n_cols: "<<start_row<<", "<<start_col<<", "<<n_rows<<", "<<n_cols<<std::endl;
+		//std::cout<<"block being approximated:"<<std::endl;
+		//std::cout<<Eigen::MatrixXd(mat->block(start_row,start_col,n_rows,n_cols))<<std::endl;
+		//std::cout<<"rk approximation: "<<std::endl;
+		//std::cout<<"a-vec"<<std::endl;
+		//std::cout<<current_block->r->a<<std::endl;
+		//std::cout<<"b-vec"<<std::endl;
+		//std::cout<<current_block->r->b<<std::endl;
+		// debug ends
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+	}
+}
+
+// helper for 'covering_leaf': true if row 'i' lies above the end of the block
+static bool ends_behind(int i, const supermat* block)
+{
+	return i < block->start_row + block->rows;
+}
+
+// position of the leaf covering row 'i' in a list of leaves sorted by rows, searching from position 'p' on
+// consecutive entries of a column mostly fall into the same leaf, which is checked first
+static unsigned int covering_leaf(const std::vector<supermat*>& list, unsigned int p, int i)
+{
+	if(ends_behind(i,list[p]))
+		return p;
+	return std::upper_bound(list.begin()+p+1,list.end(),i,ends_behind) - list.begin();
+}
+
+// extraction of all leaf blocks in one pass over the entries of the matrix
+// the leaves partition the matrix: the columns between two consecutive column offsets of leaves (a strip) are covered by the same leaves,
+// which cut the strip into row ranges, so every entry of a column is mapped to its leaf by walking down the sorted leaves of its strip
+// the strips are processed in parallel; the entries of one column of a full block always come from one thread
+void hmat::extract_leaves(std::vector<supermat*>& leaf_blocks, Eigen::SparseMatrix<double>* mat)
+{
+	int n_cols = mat->cols();
+	const int* outer = mat->outerIndexPtr();
+	const int* inner = mat->innerIndexPtr();
+	const double* values = mat->valuePtr();
+
+	// strips of columns
+	std::vector<char> strip_start(n_cols,0);
+	if(n_cols>0)
+		strip_start[0] = 1;
+	for(unsigned int l=0;l<leaf_blocks.size();l++)
+	{
+		if(leaf_blocks[l]->cols>0)
+			strip_start[leaf_blocks[l]->start_col] = 1;
+	}
+	std::vector<int> strip_begin; // strip 's' holds the columns strip_begin[s] ... strip_begin[s+1]-1
+	std::vector<int> strip_of_col(n_cols);
+	for(int j=0;j<n_cols;j++)
+	{
+		if(strip_start[j])
+			strip_begin.push_back(j);
+		strip_of_col[j] = strip_begin.size()-1;
+	}
+	int n_strips = strip_begin.size();
+	strip_begin.push_back(n_cols);
+
+	// leaves covering every strip, from top to bottom
+	std::vector<std::vector<supermat*> > strip_leaves(n_strips);
+	for(unsigned int l=0;l<leaf_blocks.size();l++)
+	{
+		supermat* block = leaf_blocks[l];
+		if(block->rows==0 || block->cols==0)
+			continue;
+		for(int st=strip_of_col[block->start_col]; st<n_strips && strip_begin[st]<block->start_col+block->cols; st++)
+			strip_leaves[st].push_back(block);
+	}
+	#pragma omp parallel for schedule(dynamic)
+	for(int st=0;st<n_strips;st++)
+		std::sort(strip_leaves[st].begin(),strip_leaves[st].end(),leaf_sort);
+
+	// first pass: number of entries in every column of the full blocks; rk blocks are only checked for a nonzero entry
+	std::vector<char> has_entries(blocks.size(),0);
+	for(unsigned int l=0;l<leaf_blocks.size();l++)
+	{
+		if(leaf_blocks[l]->type==2)
+			leaf_blocks[l]->f->m->resize(leaf_blocks[l]->rows,leaf_blocks[l]->cols); // all column counts are zero
+	}
+	#pragma omp parallel for schedule(dynamic)
+	for(int st=0;st<n_strips;st++)
+	{
+		const std::vector<supermat*>& list = strip_leaves[st];
+		for(int j=strip_begin[st];j<strip_begin[st+1];j++)
+		{
+			unsigned int p = 0;
+			for(int k=outer[j];k<outer[j+1];k++)
+			{
+				p = covering_leaf(list,p,inner[k]);
+				supermat* block = list[p];
+				if(block->type==2)
+					block->f->m->outerIndexPtr()[j - block->start_col + 1]++;
+				else if(values[k]!=0.0)
+				{
+					#pragma omp atomic write
+					has_entries[block - &blocks[0]] = 1;
+				}
+			}
+		}
+	}
+
+	// storage of the full blocks; rk blocks without entries become zero blocks
+	#pragma omp parallel for schedule(dynamic,64)
+	for(int l=0;l<int(leaf_blocks.size());l++)
+	{
+		supermat* block = leaf_blocks[l];
+		if(block->type==2)
+		{
+			int* col_ptr = block->f->m->outerIndexPtr();
+			for(int j=0;j<block->cols;j++)
+				col_ptr[j+1] += col_ptr[j];
+			block->f->m->resizeNonZeros(col_ptr[block->cols]);
+		}
+		else if(block->type==1 && !has_entries[block - &blocks[0]])
+		{
+			// no entries in this block: nothing to store
+			block->type = 4;
+			block->r = NULL;
+		}
+	}
+
+	// second pass: the entries are copied into the full blocks; they are met in order of rows, so every column stays sorted
+	#pragma omp parallel for schedule(dynamic)
+	for(int st=0;st<n_strips;st++)
+	{
+		const std::vector<supermat*>& list = strip_leaves[st];
+		for(int j=strip_begin[st];j<strip_begin[st+1];j++)
+		{
+			unsigned int p = 0;
+			for(int k=outer[j];k<outer[j+1];k++)
+			{
+				p = covering_leaf(list,p,inner[k]);
+				supermat* block = list[p];
+				if(block->type!=2)
+					continue;
+				Eigen::SparseMatrix<double>* m = block->f->m;
+				int pos = m->outerIndexPtr()[j - block->start_col]++; // the column start is used as cursor and restored below
+				m->innerIndexPtr()[pos] = inner[k] - block->start_row;
+				m->valuePtr()[pos] = values[k];
+			}
+		}
+	}
+	#pragma omp parallel for schedule(dynamic,64)
+	for(int l=0;l<int(leaf_blocks.size());l++)
+	{
+		supermat* block = leaf_blocks[l];
+		if(block->type!=2)
+			continue;
+		// every cursor stopped at the start of the next column: shift back by one column
+		int* col_ptr = block->f->m->outerIndexPtr();
+		for(int j=block->cols;j>0;j--)
+			col_ptr[j] = col_ptr[j-1];
+		col_ptr[0] = 0;
+	}
+}
+
+// memory held by the H-Matrix: block array, leaf objects, factors of the rk blocks and entries of the full blocks
+std::size_t hmat::memory_usage(void)
+{
+	std::size_t bytes = blocks.capacity()*sizeof(supermat) + idx_set.capacity()*sizeof(unsigned int);
+	bytes += leaves.capacity()*sizeof(supermat*) + leaf_part.capacity()*sizeof(int);
+	bytes += rk_pool.memory_usage() + full_pool.memory_usage() + sparse_pool.memory_usage();
+	for(unsigned int i=0;i<blocks.size();i++)
+	{
+		if(blocks[i].type==1)
+			bytes += (blocks[i].r->a.size() + blocks[i].r->b.size())*sizeof(double);
+		else if(blocks[i].type==2 && blocks[i].f->m!=NULL)
+		{
+			Eigen::SparseMatrix<double>* m = blocks[i].f->m;
+			bytes += m->nonZeros()*(sizeof(double)+sizeof(int)) + (m->outerSize()+1)*sizeof(int);
+		}
+	}
+	return bytes;
+}
+
+static const char hmat_file_magic[8] = "HMATBLK";
+static const uint32_t hmat_file_version = 1;
+
+// sections of the file start at multiples of 8 bytes
+static std::size_t align8(std::size_t offset)
+{
+	return (offset+7)/8*8;
+}
+
+// byte offsets of the sections: blocks, index set, rk values, column pointers, row indices, values, end of file
+static void hmat_file_sections(const hmat_file_header& h, std::size_t* sec)
+{
+	sec[0] = sizeof(hmat_file_header);
+	sec[1] = sec[0] + h.n_blocks*sizeof(hmat_file_block);
+	sec[2] = align8(sec[1] + h.n_idx*sizeof(uint32_t));
+	sec[3] = sec[2] + h.n_rk_values*sizeof(double);
+	sec[4] = align8(sec[3] + h.n_col_ptr*sizeof(int));
+	sec[5] = align8(sec[4] + h.n_entries*sizeof(int));
+	sec[6] = sec[5] + h.n_entries*sizeof(double);
 }
 
-__attribute__((force_align_arg_pointer)) void hmat::CA_partial_pivot(Eigen::MatrixXd& dum_mat, rkmat* rk, int r)
+// binary file: header, flattened block array, index set, rk factors, full blocks in CSC
+bool hmat::save(const std::string& filename)
+{
+	hmat_file_header h;
+	std::memcpy(h.magic, hmat_file_magic, 8);
+	h.version = hmat_file_version;
+	h.reserved = 0;
+	h.eps = eps;
+	h.n_blocks = blocks.size();
+	h.n_idx = idx_set.size();
+	h.n_rk_values = 0;
+	h.n_col_ptr = 0;
+	h.n_entries = 0;
+	std::vector<hmat_file_block> records(blocks.size());
+	for(unsigned int i=0;i<blocks.size();i++)
+	{
+		supermat* block = &blocks[i];
+		hmat_file_block& rec = records[i];
+		rec.type = block->type;
+		rec.rows = block->rows;
+		rec.cols = block->cols;
+		rec.start_row = block->start_row;
+		rec.start_col = block->start_col;
+		rec.first_child = block->first_child;
+		rec.n_child = block->n_child;
+		rec.k = 0;
+		rec.kt = 0;
+		rec.reserved = 0;
+		rec.offset = 0;
+		rec.entry_offset = 0;
+		if(block->type==1)
+		{
+			rec.k = block->r->k;
+			rec.kt = block->r->kt;
+			rec.offset = h.n_rk_values;
+			h.n_rk_values += int64_t(block->rows + block->cols)*block->r->kt;
+		}
+		else if(block->type==2)
+		{
+			if(block->f->m!=NULL)
+				block->f->m->makeCompressed();
+			rec.offset = h.n_col_ptr;
+			rec.entry_offset = h.n_entries;
+			h.n_col_ptr += block->cols + 1;
+			h.n_entries += full_block(block).nonZeros();
+		}
+	}
+
+	std::ofstream op(filename.c_str(), std::ios::binary);
+	if(!op.is_open())
+	{
+		std::cout<<"Error: file open "<<filename<<std::endl;
+		return false;
+	}
+	std::size_t sec[7];
+	hmat_file_sections(h, sec);
+	const char zeros[8] = {0,0,0,0,0,0,0,0};
+	op.write(reinterpret_cast<const char*>(&h), sizeof(h));
+	op.write(reinterpret_cast<const char*>(records.data()), records.size()*sizeof(hmat_file_block));
+	for(unsigned int i=0;i<idx_set.size();i++)
+	{
+		uint32_t idx = idx_set[i];
+		op.write(reinterpret_cast<const char*>(&idx), sizeof(idx));
+	}
+	op.write(zeros, sec[2] - (sec[1] + h.n_idx*sizeof(uint32_t)));
+	// the factors are column-major and have exactly 'kt' columns, so each is one contiguous array
+	for(unsigned int i=0;i<blocks.size();i++)
+	{
+		if(blocks[i].type!=1)
+			continue;
+		int kt = blocks[i].r->kt;
+		op.write(reinterpret_cast<const char*>(factor_a(&blocks[i]).data()), std::size_t(blocks[i].rows)*kt*sizeof(double));
+		op.write(reinterpret_cast<const char*>(factor_b(&blocks[i]).data()), std::size_t(blocks[i].cols)*kt*sizeof(double));
+	}
+	for(unsigned int i=0;i<blocks.size();i++)
+	{
+		if(blocks[i].type==2)
+			op.write(reinterpret_cast<const char*>(full_block(&blocks[i]).outerIndexPtr()), (blocks[i].cols+1)*sizeof(int));
+	}
+	op.write(zeros, sec[4] - (sec[3] + h.n_col_ptr*sizeof(int)));
+	for(unsigned int i=0;i<blocks.size();i++)
+	{
+		if(blocks[i].type==2)
+			op.write(reinterpret_cast<const char*>(full_block(&blocks[i]).innerIndexPtr()), full_block(&blocks[i]).nonZeros()*sizeof(int));
+	}
+	op.write(zeros, sec[5] - (sec[4] + h.n_entries*sizeof(int)));
+	for(unsigned int i=0;i<blocks.size();i++)
+	{
+		if(blocks[i].type==2)
+			op.write(reinterpret_cast<const char*>(full_block(&blocks[i]).valuePtr()), full_block(&blocks[i]).nonZeros()*sizeof(double));
+	}
+	if(!op.good())
+	{
+		std::cout<<"Error: writing "<<filename<<" failed"<<std::endl;
+		return false;
+	}
+	return true;
+}
+
+// checks one block record of the file against the root block and the sizes of the sections
+static bool hmat_file_block_valid(const hmat_file_header& h, const hmat_file_block* records, int64_t i, const int* col_ptr, const int* row_idx)
+{
+	const hmat_file_block& rec = records[i];
+	const hmat_file_block& root = records[0];
+	if(rec.type<1 || rec.type>4 || rec.rows<0 || rec.cols<0)
+		return false;
+	// internal blocks and only they have children
+	if((rec.type==3)!=(rec.n_child>0))
+		return false;
+	// the block lies inside the root block
+	if(rec.start_row<root.start_row || rec.start_col<root.start_col || int64_t(rec.start_row)+rec.rows>int64_t(root.start_row)+root.rows
+		|| int64_t(rec.start_col)+rec.cols>int64_t(root.start_col)+root.cols)
+		return false;
+	// children come after their parent, so the block tree has no cycles
+	if(rec.n_child>0 && (rec.first_child<=i || int64_t(rec.first_child)+rec.n_child>h.n_blocks))
+		return false;
+	if(rec.type==1)
+	{
+		// the rank is at most min(rows,cols): 'recompress' takes the top 'kt' rows of the R factors of 'a' and 'b'
+		int64_t n = int64_t(rec.rows) + rec.cols;
+		return rec.kt>=0 && rec.kt<=std::min(rec.rows, rec.cols) && rec.offset>=0 && rec.offset<=h.n_rk_values && (n==0 || rec.kt<=(h.n_rk_values - rec.offset)/n);
+	}
+	if(rec.type==2)
+	{
+		if(rec.offset<0 || rec.offset + rec.cols + 1 > h.n_col_ptr || rec.entry_offset<0 || rec.entry_offset>h.n_entries)
+			return false;
+		const int* outer = col_ptr + rec.offset;
+		if(outer[0]!=0)
+			return false;
+		for(int j=0;j<rec.cols;j++)
+		{
+			if(outer[j+1]<outer[j] || outer[j+1]>h.n_entries - rec.entry_offset)
+				return false;
+		}
+		const int* inner = row_idx + rec.entry_offset;
+		for(int k=0;k<outer[rec.cols];k++)
+		{
+			if(inner[k]<0 || inner[k]>=rec.rows)
+				return false;
+		}
+	}
+	return true;
+}
+
+// sorts the intervals [begin,begin+size) and checks that the distinct ones split [begin,begin+size) of the parent without gaps or overlaps
+static bool hmat_file_partition(std::vector<std::pair<int32_t,int32_t> >& v, int32_t begin, int32_t size)
+{
+	std::sort(v.begin(), v.end());
+	v.erase(std::unique(v.begin(), v.end()), v.end());
+	int64_t next = begin;
+	for(unsigned int k=0;k<v.size();k++)
+	{
+		if(v[k].first!=next || v[k].second<=0)
+			return false;
+		next += v[k].second;
+	}
+	return next==int64_t(begin)+size;
+}
+
+// checks the block tree of the file: the root is the whole matrix, every other block is the child of exactly one block, and the children
+// of every internal block tile it exactly, as the cartesian product of a partition of its rows and a partition of its cols.
+// Together with 'hmat_file_block_valid' this keeps the products within the vectors of size 'rows' of the root.
+static bool hmat_file_tree_valid(const hmat_file_header& h, const hmat_file_block* records)
+{
+	const hmat_file_block& root = records[0];
+	if(root.start_row!=0 || root.start_col!=0 || (h.n_idx>0 && (root.rows!=h.n_idx || root.cols!=h.n_idx)))
+		return false;
+	std::vector<char> has_parent(h.n_blocks,0);
+	std::vector<std::pair<int32_t,int32_t> > row_parts, col_parts, cells;
+	for(int64_t i=0;i<h.n_blocks;i++)
+	{
+		const hmat_file_block& rec = records[i];
+		if(rec.n_child==0)
+			continue;
+		row_parts.clear();
+		col_parts.clear();
+		cells.clear();
+		for(uint32_t c=rec.first_child;c<rec.first_child+rec.n_child;c++)
+		{
+			if(has_parent[c])
+				return false;
+			has_parent[c] = 1;
+			row_parts.push_back(std::make_pair(records[c].start_row, records[c].rows));
+			col_parts.push_back(std::make_pair(records[c].start_col, records[c].cols));
+			cells.push_back(std::make_pair(records[c].start_row, records[c].start_col));
+		}
+		if(!hmat_file_partition(row_parts, rec.start_row, rec.rows) || !hmat_file_partition(col_parts, rec.start_col, rec.cols))
+			return false;
+		// every pair of a row part and a col part is one child
+		std::sort(cells.begin(), cells.end());
+		if(std::unique(cells.begin(), cells.end())!=cells.end() || cells.size()!=row_parts.size()*col_parts.size())
+			return false;
+	}
+	for(int64_t i=1;i<h.n_blocks;i++)
+	{
+		if(!has_parent[i])
+			return false;
+	}
+	return true;
+}
+
+// the file is mapped and the leaves point into it; nothing is parsed or copied, and the mapping is kept until the H-Matrix is rebuilt, loaded again or destroyed
+// the whole file is validated before '*this' is changed, so a failed load leaves the hmat (and the file its leaves may point into) as it was
+bool hmat::load(const std::string& filename)
+{
+	mapped_file mapping;
+	if(!mapping.open(filename))
+		return false;
+	hmat_file_header h;
+	if(mapping.size()<sizeof(h))
+	{
+		std::cout<<"Error in hmat::load: "<<filename<<" is too short"<<std::endl;
+		return false;
+	}
+	std::memcpy(&h, mapping.begin(), sizeof(h));
+	if(std::memcmp(h.magic, hmat_file_magic, 8)!=0 || h.version!=hmat_file_version)
+	{
+		std::cout<<"Error in hmat::load: "<<filename<<" is not an H-Matrix file of version "<<hmat_file_version<<std::endl;
+		return false;
+	}
+	// no section is longer than the file, so the offsets of the sections cannot overflow
+	int64_t n_max = mapping.size();
+	std::size_t sec[7];
+	bool valid = (h.n_blocks>=1 && h.n_idx>=0 && h.n_rk_values>=0 && h.n_col_ptr>=0 && h.n_entries>=0
+		&& h.n_blocks<=n_max && h.n_idx<=n_max && h.n_rk_values<=n_max && h.n_col_ptr<=n_max && h.n_entries<=n_max);
+	if(valid)
+	{
+		hmat_file_sections(h, sec);
+		valid = (mapping.size()>=sec[6]);
+	}
+	if(!valid)
+	{
+		std::cout<<"Error in hmat::load: sizes in the header of "<<filename<<" do not match the file"<<std::endl;
+		return false;
+	}
+	const hmat_file_block* records = reinterpret_cast<const hmat_file_block*>(mapping.begin() + sec[0]);
+	const uint32_t* idx = reinterpret_cast<const uint32_t*>(mapping.begin() + sec[1]);
+	const double* rk_values = reinterpret_cast<const double*>(mapping.begin() + sec[2]);
+	const int* col_ptr = reinterpret_cast<const int*>(mapping.begin() + sec[3]);
+	const int* row_idx = reinterpret_cast<const int*>(mapping.begin() + sec[4]);
+	const double* values = reinterpret_cast<const double*>(mapping.begin() + sec[5]);
+
+	// the index set is empty or a permutation of the rows of the root block
+	valid = (h.n_idx==0 || (records[0].rows==records[0].cols && h.n_idx==records[0].rows));
+	std::vector<char> seen(h.n_idx,0);
+	for(int64_t i=0;valid && i<h.n_idx;i++)
+	{
+		valid = (idx[i]<h.n_idx && !seen[idx[i]]);
+		if(valid)
+			seen[idx[i]] = 1;
+	}
+	if(!valid)
+	{
+		std::cout<<"Error in hmat::load: the index set in "<<filename<<" does not match the matrix"<<std::endl;
+		return false;
+	}
+	for(int64_t i=0;i<h.n_blocks;i++)
+	{
+		if(!hmat_file_block_valid(h, records, i, col_ptr, row_idx))
+		{
+			std::cout<<"Error in hmat::load: invalid block "<<i<<" in "<<filename<<std::endl;
+			return false;
+		}
+	}
+	if(!hmat_file_tree_valid(h, records))
+	{
+		std::cout<<"Error in hmat::load: the blocks in "<<filename<<" do not tile the matrix"<<std::endl;
+		return false;
+	}
+
+	eps = h.eps;
+	idx_set.assign(idx, idx + h.n_idx);
+	leaves.clear();
+	leaf_part.clear();
+	rk_pool.clear();
+	full_pool.clear();
+	sparse_pool.clear();
+	file.swap(mapping); // the previous mapping is released on return
+	blocks.resize(h.n_blocks);
+	for(unsigned int i=0;i<blocks.size();i++)
+	{
+		const hmat_file_block& rec = records[i];
+		supermat* block = &blocks[i];
+		block->type = rec.type;
+		block->rows = rec.rows;
+		block->cols = rec.cols;
+		block->start_row = rec.start_row;
+		block->start_col = rec.start_col;
+		block->first_child = rec.first_child;
+		block->n_child = rec.n_child;
+		block->r = NULL;
+		block->f = NULL;
+		if(rec.type==1)
+		{
+			rkmat* rk = rk_pool.create();
+			rk->k = rec.k;
+			rk->kt = rec.kt;
+			rk->mapped_a = rk_values + rec.offset;
+			rk->mapped_b = rk_values + rec.offset + int64_t(rec.rows)*rec.kt;
+			block->r = rk;
+		}
+		else if(rec.type==2)
+		{
+			fullmat* f = full_pool.create();
+			f->m = NULL;
+			f->mapped_col_ptr = col_ptr + rec.offset;
+			f->mapped_row_idx = row_idx + rec.entry_offset;
+			f->mapped_values = values + rec.entry_offset;
+			block->f = f;
+		}
+	}
+	return true;
+}
+
+// dense block accessed by the cross approximation
+struct dense_block
+{
+	Eigen::MatrixXd& m;
+	dense_block(Eigen::MatrixXd& x) : m(x) {}
+	int rows(void) { return m.rows(); }
+	int cols(void) { return m.cols(); }
+	void add_row(int i, Eigen::VectorXd& v) { v += m.row(i).transpose(); }
+	void add_col(int j, Eigen::VectorXd& v) { v += m.col(j); }
+	void nonempty_rows(std::vector<int>& v) { for(int i=0;i<m.rows();i++) v.push_back(i); }
+	void nonempty_cols(std::vector<int>& v) { for(int j=0;j<m.cols();j++) v.push_back(j); }
+	double squared_norm(void) { return m.squaredNorm(); }
+	double residual_dot(const Eigen::MatrixXd& a, const Eigen::MatrixXd& b, int q, std::vector<bool>& used_rows, std::vector<bool>& used_cols, int& i_max, int& j_max)
+	{
+		// column by column, so the approximation is never formed as a whole
+		double dot = 0.0;
+		double res_max = 0.0;
+		i_max = -1;
+		j_max = -1;
+		Eigen::VectorXd s = Eigen::VectorXd::Zero(m.rows());
+		for(int j=0;j<m.cols();j++)
+		{
+			if(q>0)
+				s.noalias() = a.leftCols(q)*b.row(j).head(q).transpose();
+			dot += m.col(j).dot(s);
+			if(used_cols[j])
+				continue;
+			for(int i=0;i<m.rows();i++)
+			{
+				double res = std::abs(m(i,j) - s(i));
+				if(res>res_max && !used_rows[i])
+				{
+					res_max = res;
+					i_max = i;
+					j_max = j;
+				}
+			}
+		}
+		return dot;
+	}
+};
+
+int sparse_block::rows(void)
+{
+	return n_rows;
+}
+
+int sparse_block::cols(void)
+{
+	return n_cols;
+}
+
+void sparse_block::add_row(int i, Eigen::VectorXd& v)
+{
+	// entries of the row inside the block are found by binary search over the sorted column indices
+	const int* row_begin = csr->innerIndexPtr() + csr->outerIndexPtr()[start_row+i];
+	const int* row_end = csr->innerIndexPtr() + csr->outerIndexPtr()[start_row+i+1];
+	const double* values = csr->valuePtr();
+	for(const int* itr = std::lower_bound(row_begin,row_end,start_col); itr!=row_end && *itr<start_col+n_cols; ++itr)
+		v(*itr-start_col) += values[itr-csr->innerIndexPtr()];
+}
+
+void sparse_block::add_col(int j, Eigen::VectorXd& v)
+{
+	const int* col_begin = csc->innerIndexPtr() + csc->outerIndexPtr()[start_col+j];
+	const int* col_end = csc->innerIndexPtr() + csc->outerIndexPtr()[start_col+j+1];
+	const double* values = csc->valuePtr();
+	for(const int* itr = std::lower_bound(col_begin,col_end,start_row); itr!=col_end && *itr<start_row+n_rows; ++itr)
+		v(*itr-start_row) += values[itr-csc->innerIndexPtr()];
+}
+
+void sparse_block::nonempty_rows(std::vector<int>& v)
+{
+	const int* inner = csr->innerIndexPtr();
+	const int* outer = csr->outerIndexPtr();
+	for(int i=0;i<n_rows;i++)
+	{
+		const int* itr = std::lower_bound(inner+outer[start_row+i],inner+outer[start_row+i+1],start_col);
+		if(itr!=inner+outer[start_row+i+1] && *itr<start_col+n_cols)
+			v.push_back(i);
+	}
+}
+
+void sparse_block::nonempty_cols(std::vector<int>& v)
+{
+	const int* inner = csc->innerIndexPtr();
+	const int* outer = csc->outerIndexPtr();
+	for(int j=0;j<n_cols;j++)
+	{
+		const int* itr = std::lower_bound(inner+outer[start_col+j],inner+outer[start_col+j+1],start_row);
+		if(itr!=inner+outer[start_col+j+1] && *itr<start_row+n_rows)
+			v.push_back(j);
+	}
+}
+
+double sparse_block::squared_norm(void)
+{
+	double norm2 = 0.0;
+	const double* values = csc->valuePtr();
+	for(int j=0;j<n_cols;j++)
+	{
+		const int* col_begin = csc->innerIndexPtr() + csc->outerIndexPtr()[start_col+j];
+		const int* col_end = csc->innerIndexPtr() + csc->outerIndexPtr()[start_col+j+1];
+		for(const int* itr = std::lower_bound(col_begin,col_end,start_row); itr!=col_end && *itr<start_row+n_rows; ++itr)
+			norm2 += values[itr-csc->innerIndexPtr()]*values[itr-csc->innerIndexPtr()];
+	}
+	return norm2;
+}
+
+double sparse_block::residual_dot(const Eigen::MatrixXd& a, const Eigen::MatrixXd& b, int q, std::vector<bool>& used_rows, std::vector<bool>& used_cols, int& i_max, int& j_max)
+{
+	double dot = 0.0;
+	double res_max = 0.0;
+	i_max = -1;
+	j_max = -1;
+	const double* values = csc->valuePtr();
+	for(int j=0;j<n_cols;j++)
+	{
+		const int* col_begin = csc->innerIndexPtr() + csc->outerIndexPtr()[start_col+j];
+		const int* col_end = csc->innerIndexPtr() + csc->outerIndexPtr()[start_col+j+1];
+		for(const int* itr = std::lower_bound(col_begin,col_end,start_row); itr!=col_end && *itr<start_row+n_rows; ++itr)
+		{
+			int i = *itr-start_row;
+			double v = values[itr-csc->innerIndexPtr()];
+			double s = (q==0) ? 0.0 : a.row(i).head(q).dot(b.row(j).head(q));
+			dot += v*s;
+			double res = std::abs(v - s);
+			if(res>res_max && !used_rows[i] && !used_cols[j])
+			{
+				res_max = res;
+				i_max = i;
+				j_max = j;
+			}
+		}
+	}
+	return dot;
+}
+
+void sparse_block::get_block(Eigen::SparseMatrix<double>& b)
+{
+	b.resize(n_rows,n_cols);
+	std::vector<Eigen::Triplet<double> > entries;
+	const double* values = csc->valuePtr();
+	for(int j=0;j<n_cols;j++)
+	{
+		const int* col_begin = csc->innerIndexPtr() + csc->outerIndexPtr()[start_col+j];
+		const int* col_end = csc->innerIndexPtr() + csc->outerIndexPtr()[start_col+j+1];
+		for(const int* itr = std::lower_bound(col_begin,col_end,start_row); itr!=col_end && *itr<start_row+n_rows; ++itr)
+			entries.push_back(Eigen::Triplet<double>(*itr-start_row,j,values[itr-csc->innerIndexPtr()]));
+	}
+	b.setFromTriplets(entries.begin(),entries.end());
+}
+
+// the exact residual is computed as ||B||^2 - 2<B,S_k> + ||S_k||^2, which loses about this much relative to ||B||^2 + ||S_k||^2 by cancellation;
+// a residual below that counts as zero. Likewise, an entry of a residual row or column up to this much of the largest pivot is rounding error.
+static const double aca_rounding = 1e-14;
+
+// next reference from the candidates 'cand', skipping the ones used as pivots; negative if there is none
+// 'pos' only moves forward, so every candidate is looked at once
+static int next_reference(const std::vector<int>& cand, unsigned int& pos, std::vector<bool>& used)
+{
+	while(pos<cand.size() && used[cand[pos]])
+		pos++;
+	if(pos==cand.size())
+		return -1;
+	return cand[pos++];
+}
+
+// ||S_q||_F^2 of the first 'q' terms of the approximation, from the Gram matrices of the factors: O((rows+cols)*q^2)
+static double approx_norm2(rkmat* rk, int q)
+{
+	if(q==0)
+		return 0.0;
+	Eigen::MatrixXd ga = rk->a.leftCols(q).transpose()*rk->a.leftCols(q);
+	Eigen::MatrixXd gb = rk->b.leftCols(q).transpose()*rk->b.leftCols(q);
+	return ga.cwiseProduct(gb).sum();
+}
+
+// residual of row 'i' of the block: the row minus the first 'q' terms of the approximation
+template <class Block>
+static void residual_row(Block& blk, rkmat* rk, int q, int i, Eigen::VectorXd& v)
+{
+	if(q==0)
+		v.setZero(blk.cols());
+	else
+		v.noalias() = (-1.0)*rk->b.leftCols(q)*rk->a.row(i).head(q).transpose();
+	blk.add_row(i, v);
+}
+
+// residual of column 'j' of the block
+template <class Block>
+static void residual_col(Block& blk, rkmat* rk, int q, int j, Eigen::VectorXd& v)
+{
+	if(q==0)
+		v.setZero(blk.rows());
+	else
+		v.noalias() = (-1.0)*rk->a.leftCols(q)*rk->b.row(j).head(q).transpose();
+	blk.add_col(j, v);
+}
+
+// entry with the largest residual in the rows of 'cand_rows' and the columns not used as pivots; returns its magnitude, or 0 if there is none.
+// Only the non-empty rows and columns can have a residual, but it may lie on entries which are not stored. Costs O(#rows*(cols*q + nnz of a row)).
+template <class Block>
+static double largest_residual(Block& blk, rkmat* rk, int q, const std::vector<int>& cand_rows, std::vector<bool>& used_rows, std::vector<bool>& used_cols, int& i_max, int& j_max)
+{
+	double res_max = 0.0;
+	i_max = -1;
+	j_max = -1;
+	Eigen::VectorXd v(blk.cols());
+	for(unsigned int p=0;p<cand_rows.size();p++)
+	{
+		int i = cand_rows[p];
+		if(used_rows[i])
+			continue;
+		residual_row(blk, rk, q, i, v);
+		int j = find_index(v, used_cols);
+		if(j>=0 && std::abs(v(j))>res_max)
+		{
+			res_max = std::abs(v(j));
+			i_max = i;
+			j_max = j;
+		}
+	}
+	return res_max;
+}
+
+// ACA+ on a block which only needs to provide single rows and columns
+// the residual of a reference row and a reference column are kept up to date; the next pivot is taken from the larger of the two,
+// so a zero row of the residual never stalls the iteration
+// the references are taken only from the rows and columns which hold entries: every other row and column of the residual is zero,
+// and the rank is at most the number of non-empty rows and columns; so a block with few entries costs O(k*(rows+cols)) as well
+// a zero residual on the references, or a small last term, does not prove that the block is approximated: entries which are not coupled
+// to the rows and columns seen so far are common in sparse blocks. So before stopping, the exact residual ||B-S_k||_F is computed over the
+// entries of the block in O(nnz*k); if it is not below 'eps'*||B||_F (zero up to rounding for 'eps'=0), the entry with the largest residual
+// becomes the next pivot. If no stored entry has a residual left, it lies on entries which are not stored, and the residual rows of all unused
+// non-empty rows are searched instead. Every failed check adds a term, so there are at most k checks.
+template <class Block>
+void aca_plus(Block& blk, rkmat* rk, int r, double eps)
+{
+	int n_rows = blk.rows();
+	int n_cols = blk.cols();
+	std::vector<int> cand_rows, cand_cols; // candidates for the references
+	blk.nonempty_rows(cand_rows);
+	blk.nonempty_cols(cand_cols);
+	unsigned int next_row = 0, next_col = 0;
+	double block_norm2 = -1.0; // ||B||_F^2; negative until the first exact residual check
+	int max_rank = std::min(r, int(std::min(cand_rows.size(), cand_cols.size())));
+	if(max_rank<0)
+		max_rank = 0;
+
+	rk->k = r;
+	rk->mapped_a = NULL;
+	rk->mapped_b = NULL;
+	// the factors are allocated once for the maximum rank and shrunk at the end
+	rk->a = Eigen::MatrixXd::Zero(n_rows,max_rank);
+	rk->b = Eigen::MatrixXd::Zero(n_cols,max_rank);
+
+	std::vector<bool> used_rows(n_rows,false), used_cols(n_cols,false);
+	Eigen::VectorXd a_vec(n_rows), b_vec(n_cols);
+	Eigen::VectorXd ref_row(n_cols), ref_col(n_rows);
+	int i_ref = -1;
+	int j_ref = -1;
+	int q = 0; // number of columns of 'a' and 'b' computed so far
+	double norm2 = 0.0; // squared Frobenius norm of the current approximation
+	bool check = false; // compute the exact residual before going on
+	double zero_tol = 0.0; // residual entries up to this size are rounding errors of the pivots so far
+
+	while(q<max_rank)
+	{
+		int current_i = -1, current_j = -1;
+		if(check)
+		{
+			check = false;
+			if(block_norm2<0.0)
+				block_norm2 = blk.squared_norm();
+			double s_norm2 = approx_norm2(rk, q);
+			double res2 = block_norm2 - 2.0*blk.residual_dot(rk->a, rk->b, q, used_rows, used_cols, current_i, current_j) + s_norm2;
+			if(res2 <= eps*eps*block_norm2 + aca_rounding*(block_norm2 + s_norm2))
+				break;
+			if(current_i<0 && largest_residual(blk, rk, q, cand_rows, used_rows, used_cols, current_i, current_j)<=zero_tol)
+				break; // no entry of the residual is above rounding
+			// pivot on the entry with the largest residual
+			residual_col(blk, rk, q, current_j, a_vec);
+			residual_row(blk, rk, q, current_i, b_vec);
+		}
+		else
+		{
+			// replace the reference row if it became a pivot row or its residual vanished
+			int j_ref_max = (i_ref<0 || used_rows[i_ref]) ? -1 : find_index(ref_row, used_cols);
+			if(j_ref_max<0 || std::abs(ref_row(j_ref_max))<=zero_tol)
+			{
+				i_ref = next_reference(cand_rows, next_row, used_rows);
+				j_ref_max = -1;
+				if(i_ref>=0)
+				{
+					residual_row(blk, rk, q, i_ref, ref_row);
+					j_ref_max = find_index(ref_row, used_cols);
+				}
+			}
+			// same for the reference column
+			int i_ref_max = (j_ref<0 || used_cols[j_ref]) ? -1 : find_index(ref_col, used_rows);
+			if(i_ref_max<0 || std::abs(ref_col(i_ref_max))<=zero_tol)
+			{
+				j_ref = next_reference(cand_cols, next_col, used_cols);
+				i_ref_max = -1;
+				if(j_ref>=0)
+				{
+					residual_col(blk, rk, q, j_ref, ref_col);
+					i_ref_max = find_index(ref_col, used_rows);
+				}
+			}
+
+			double row_max = (j_ref_max<0) ? 0.0 : std::abs(ref_row(j_ref_max));
+			double col_max = (i_ref_max<0) ? 0.0 : std::abs(ref_col(i_ref_max));
+			if(row_max<=zero_tol && col_max<=zero_tol)
+			{
+				// the residual vanishes on a fresh reference row and column; only the exact residual shows whether the block is approximated
+				check = true;
+				continue;
+			}
+			if(row_max>=col_max)
+			{
+				// pivot column from the reference row, pivot row from that column
+				current_j = j_ref_max;
+				residual_col(blk, rk, q, current_j, a_vec);
+				current_i = find_index(a_vec, used_rows);
+				residual_row(blk, rk, q, current_i, b_vec);
+			}
+			else
+			{
+				// pivot row from the reference column, pivot column from that row
+				current_i = i_ref_max;
+				residual_row(blk, rk, q, current_i, b_vec);
+				current_j = find_index(b_vec, used_cols);
+				residual_col(blk, rk, q, current_j, a_vec);
+			}
+		}
+		used_rows[current_i] = true;
+		used_cols[current_j] = true;
+
+		double delta = a_vec(current_i);
+		if(std::abs(delta)<=zero_tol)
+			continue;
+		zero_tol = std::max(zero_tol, aca_rounding*std::abs(delta));
+		b_vec /= delta;
+
+		// incremental update of ||S_k||_F^2
+		double a_norm2 = a_vec.squaredNorm();
+		double b_norm2 = b_vec.squaredNorm();
+		double cross = 0.0;
+		if(q>0)
+			cross = (rk->a.leftCols(q).transpose()*a_vec).dot(rk->b.leftCols(q).transpose()*b_vec);
+		norm2 += 2.0*cross + a_norm2*b_norm2;
+
+		rk->a.col(q) = a_vec;
+		rk->b.col(q) = b_vec;
+		q = q+1;
+
+		// update the residual of the references
+		if(i_ref>=0)
+			ref_row -= a_vec(i_ref)*b_vec;
+		if(j_ref>=0)
+			ref_col -= b_vec(j_ref)*a_vec;
+
+		if(eps>0.0 && std::sqrt(a_norm2*b_norm2) <= eps*std::sqrt(norm2))
+			check = true;
+	}
+
+	rk->a.conservativeResize(Eigen::NoChange,q);
+	rk->b.conservativeResize(Eigen::NoChange,q);
+	rk->kt = q;
+}
+
+__attribute__((force_align_arg_pointer)) void hmat::CA_partial_pivot(Eigen::MatrixXd& dum_mat, rkmat* rk, int r, double eps)
 {
 	// Cross Approximation with partial pivoting
-	// input: required rank
+	// input: required rank (or maximum rank if 'eps' is set)
 	// ouput: 'rk' matrix is filled
-	bool db=0;
-
-	if (db)
-        std::cout<<"Inside cross approx."<<std::endl;
-    rk->k=r;
-    //Eigen::MatrixXd dum_mat = Eigen::MatrixXd(dum_mat1);
-	unsigned int current_i=0;
-	unsigned int current_j=0;
-	std::vector<int> collected_indicies;
-
-	int mu = 1;
-    Eigen::MatrixXd::Index max_index;
-    if (db)
-        std::cout<<"DB1"<<std::endl;
-	while(mu<=r)
-    {
-        dum_mat.row(current_i).maxCoeff(&max_index);
-        current_j = int(max_index);
-        if (db)
-            std::cout<<"DB2"<<std::endl;
-        double rk_sum=0.0;
+	if(eps>0.0 && r<=0)
+		r = std::min(dum_mat.rows(),dum_mat.cols());
+	dense_block blk(dum_mat);
+	aca_plus(blk, rk, r, eps);
+}
 
-        for(unsigned int i=1;i<mu;i++)
-        {
-            rk_sum = rk_sum + (rk->a.at(i-1)(current_i))*(rk->b.at(i-1)(current_j));
-        }
-        if (db)
-            std::cout<<"DB3"<<std::endl;
-        double delta = dum_mat(current_i,current_j) - rk_sum;
-        if (db)
-            std::cout<<"DB: special"<<std::endl;
-        Eigen::VectorXd a_vec = Eigen::VectorXd::Zero(dum_mat.rows(),1);
-        if (db)
-            std::cout<<"DB: special1"<<std::endl;
-        Eigen::VectorXd b_vec = Eigen::VectorXd::Zero(dum_mat.cols(),1);
-        if (db)
-            std::cout<<"DB4"<<std::endl;
-        if (db)
-            std::cout<<"delta: "<<delta<<std::endl;
-        if (delta==0)
-        {
-            if (db)
-                std::cout<<"inside delta==0"<<std::endl;
-            if(collected_indicies.size()==dum_mat.rows()-1)
-                break;
-            else
-                mu=mu-1;
-        }
-        else
-        {
-            if (db)
-                std::cout<<"DB6"<<std::endl;
-            for(unsigned int i=1;i<mu;i++)
-            {
-                a_vec = a_vec + (rk->a.at(i-1))*(rk->b.at(i-1)(current_j));
-                b_vec = b_vec + (rk->a.at(i-1)(current_i))*(rk->b.at(i-1));
-            }
-            if (db)
-                std::cout<<"DB7"<<std::endl;
-            a_vec = dum_mat.block(0,current_j,dum_mat.rows(),1) - a_vec;
-            b_vec = (dum_mat.block(current_i,0,1,dum_mat.cols()).transpose() - b_vec)/delta;
-            if (db)
-                std::cout<<"DB8"<<std::endl;
-            rk->a.push_back(a_vec);
-            rk->b.push_back(b_vec);
-        }
-        if (db)
-            std::cout<<"DB5"<<std::endl;
-        collected_indicies.push_back(current_i);
-        current_i = find_index(a_vec,collected_indicies);
+__attribute__((force_align_arg_pointer)) void hmat::CA_partial_pivot(sparse_block& blk, rkmat* rk, int r, double eps)
+{
+	// same as above, but the rows and columns are read from the sparse matrix
+	if(eps>0.0 && r<=0)
+		r = std::min(blk.rows(),blk.cols());
+	aca_plus(blk, rk, r, eps);
+}
 
-        if(current_i<0)
-            break;
+// orthonormal basis of the columns of 'y'
+static Eigen::MatrixXd orth(const Eigen::MatrixXd& y)
+{
+	Eigen::HouseholderQR<Eigen::MatrixXd> qr(y);
+	return qr.householderQ()*Eigen::MatrixXd::Identity(y.rows(),y.cols());
+}
 
-        mu = mu+1;
-    }
+// number of random samples of the first range: the rank bound plus oversampling or, without a rank bound, a small start which is grown until the accuracy is reached
+static const int rsvd_oversampling = 10;
+static const int rsvd_power = 2; // power iterations sharpen the decay of the singular values
 
-    rk->kt = mu;
+static int rsvd_sample_size(int n_rows, int n_cols, int r, double eps)
+{
+	int max_rank = std::min(n_rows,n_cols);
+	if(r>0)
+		max_rank = std::min(r,max_rank);
+	if(eps>0.0 && r<=0)
+		return std::min(16 + rsvd_oversampling, std::min(n_rows,n_cols));
+	return std::min(max_rank + rsvd_oversampling, std::min(n_rows,n_cols));
 }
 
+// random samples of a block; the seed only depends on the block, so the result does not depend on the order in which blocks are built
+static void rsvd_samples(std::mt19937& gen, Eigen::MatrixXd& omega)
+{
+	std::normal_distribution<double> normal(0.0,1.0);
+	for(int i=0;i<omega.size();i++)
+		omega.data()[i] = normal(gen);
+}
 
-int find_index(Eigen::VectorXd& vec, std::vector<int>& collected_idx)
+// factors of 'rk' from the orthonormal range 'Q' (rows x l) of the block and C = Q^T B (l x cols): small SVD of C and truncation to the rank bound and to 'eps'.
+// Returns false, leaving 'rk' unchanged, if the sampled range shows no gap and 'l' may still grow.
+static bool rsvd_factors(const Eigen::MatrixXd& Q, const Eigen::MatrixXd& C, rkmat* rk, int r, double eps)
 {
-    vec = vec.cwiseAbs();
+	int n_rows = Q.rows();
+	int n_cols = C.cols();
+	int l = Q.cols();
+	int max_rank = std::min(n_rows,n_cols);
+	if(r>0)
+		max_rank = std::min(r,max_rank);
+	Eigen::JacobiSVD<Eigen::MatrixXd> svd(C, Eigen::ComputeThinU | Eigen::ComputeThinV);
+	const Eigen::VectorXd& sigma = svd.singularValues();
 
-    struct new_el arr[vec.size()];
+	int k = std::min(max_rank,int(sigma.size()));
+	if(eps>0.0)
+	{
+		double total = sigma.squaredNorm();
+		double dropped = 0.0;
+		for(int i=sigma.size()-1;i>=0;i--)
+		{
+			dropped += sigma(i)*sigma(i);
+			if(dropped > eps*eps*total)
+				break;
+			k = std::min(k,i);
+		}
+		// no gap inside the sampled range: sample a larger range if the rank bound allows it
+		if(k==int(sigma.size()) && l<std::min(n_rows,n_cols) && (r<=0 || l<max_rank+rsvd_oversampling))
+			return false;
+	}
+	while(k>0 && sigma(k-1)==0.0)
+		k--;
 
-    for(int i=0;i<vec.size();i++)
-    {
-        arr[i].val = vec(i);
-        arr[i].idx = i;
-    }
+	rk->a.noalias() = Q*(svd.matrixU().leftCols(k)*sigma.head(k).asDiagonal());
+	rk->b = svd.matrixV().leftCols(k);
+	rk->kt = k;
+	return true;
+}
+
+void hmat::RSVD(sparse_block& blk, rkmat* rk, int r, double eps)
+{
+	// randomized SVD (Halko, Martinsson, Tropp): B ~ Q*(Q^T B), where Q spans the range of B*Omega
+	int n_rows = blk.rows();
+	int n_cols = blk.cols();
+
+	Eigen::SparseMatrix<double> B;
+	blk.get_block(B);
+	Eigen::SparseMatrix<double> Bt = B.transpose();
+	std::mt19937 gen(blk.start_row*7919u + blk.start_col);
+
+	rk->k = r;
+	rk->mapped_a = NULL;
+	rk->mapped_b = NULL;
+	int l = rsvd_sample_size(n_rows, n_cols, r, eps);
+	while(true)
+	{
+		Eigen::MatrixXd omega(n_cols,l);
+		rsvd_samples(gen, omega);
+
+		Eigen::MatrixXd Q = orth(B*omega);
+		for(int p=0;p<rsvd_power;p++)
+		{
+			Eigen::MatrixXd Z = orth(Bt*Q);
+			Q = orth(B*Z);
+		}
+		// Q^T B = (B^T Q)^T
+		if(rsvd_factors(Q, (Bt*Q).transpose(), rk, r, eps))
+			break;
+		l = std::min(2*l, std::min(n_rows,n_cols));
+	}
+}
+
+// replaces the rows offset[b] ... offset[b+1]-1 of 'y' by an orthonormal basis of their columns, for every block 'b' of a batch
+static void orth_blocks(Eigen::MatrixXd& y, const std::vector<int>& offset)
+{
+	#pragma omp parallel for schedule(dynamic)
+	for(int b=0;b<int(offset.size())-1;b++)
+		y.middleRows(offset[b], offset[b+1]-offset[b]) = orth(y.middleRows(offset[b], offset[b+1]-offset[b]));
+}
+
+void hmat::RSVD(std::vector<sparse_block>& blks, std::vector<rkmat*>& rks, int r, double eps)
+{
+	// the blocks are batched by their number of samples: the blocks of a batch are the diagonal blocks of one sparse matrix D, so every product
+	// of the randomized SVD is one product of D or D^T (row major, which Eigen runs in parallel) with a tall matrix holding the thin matrices of all
+	// blocks, and only the small QR and SVD factorizations are done block by block, in parallel
+	std::vector<std::pair<int,int> > samples(blks.size()); // number of samples and index of every block, sorted
+	for(unsigned int i=0;i<blks.size();i++)
+		samples[i] = std::make_pair(rsvd_sample_size(blks[i].rows(), blks[i].cols(), r, eps), int(i));
+	std::sort(samples.begin(), samples.end());
+	std::vector<int> order(blks.size());
+	for(unsigned int i=0;i<blks.size();i++)
+		order[i] = samples[i].second;
+
+	std::vector<int> retry; // blocks whose sampled range was too small; they grow it on their own
+	for(unsigned int begin=0;begin<order.size();)
+	{
+		unsigned int end = begin;
+		while(end<order.size() && samples[end].first==samples[begin].first)
+			end++;
+		int n_batch = end - begin;
+		int n_samples = samples[begin].first;
+
+		// offsets of the blocks in D
+		std::vector<int> row_offset(n_batch+1,0), col_offset(n_batch+1,0);
+		for(int b=0;b<n_batch;b++)
+		{
+			row_offset[b+1] = row_offset[b] + blks[order[begin+b]].rows();
+			col_offset[b+1] = col_offset[b] + blks[order[begin+b]].cols();
+		}
+		std::vector<Eigen::Triplet<double> > entries;
+		Eigen::MatrixXd omega(col_offset[n_batch], n_samples);
+		for(int b=0;b<n_batch;b++)
+		{
+			sparse_block& blk = blks[order[begin+b]];
+			Eigen::SparseMatrix<double> B;
+			blk.get_block(B);
+			for(int j=0;j<B.outerSize();j++)
+				for(Eigen::SparseMatrix<double>::InnerIterator itr(B,j);itr;++itr)
+					entries.push_back(Eigen::Triplet<double>(row_offset[b]+itr.row(), col_offset[b]+j, itr.value()));
+			// the same samples as for the block on its own
+			std::mt19937 gen(blk.start_row*7919u + blk.start_col);
+			Eigen::MatrixXd omega_b(blk.cols(), n_samples);
+			rsvd_samples(gen, omega_b);
+			omega.middleRows(col_offset[b], blk.cols()) = omega_b;
+		}
+		Eigen::SparseMatrix<double,Eigen::RowMajor> D(row_offset[n_batch], col_offset[n_batch]);
+		D.setFromTriplets(entries.begin(), entries.end());
+		Eigen::SparseMatrix<double,Eigen::RowMajor> Dt = D.transpose();
+
+		Eigen::MatrixXd Q = D*omega;
+		orth_blocks(Q, row_offset);
+		for(int p=0;p<rsvd_power;p++)
+		{
+			Eigen::MatrixXd Z = Dt*Q;
+			orth_blocks(Z, col_offset);
+			Q = D*Z;
+			orth_blocks(Q, row_offset);
+		}
+		Eigen::MatrixXd Ct = Dt*Q;
+
+		std::vector<char> done(n_batch);
+		#pragma omp parallel for schedule(dynamic)
+		for(int b=0;b<n_batch;b++)
+		{
+			rkmat* rk = rks[order[begin+b]];
+			rk->k = r;
+			rk->mapped_a = NULL;
+			rk->mapped_b = NULL;
+			done[b] = rsvd_factors(Q.middleRows(row_offset[b], row_offset[b+1]-row_offset[b]), Ct.middleRows(col_offset[b], col_offset[b+1]-col_offset[b]).transpose(), rk, r, eps);
+		}
+		for(int b=0;b<n_batch;b++)
+		{
+			if(!done[b])
+				retry.push_back(order[begin+b]);
+		}
+		begin = end;
+	}
+
+	#pragma omp parallel for schedule(dynamic,1)
+	for(int t=0;t<int(retry.size());t++)
+		RSVD(blks[retry[t]], rks[retry[t]], r, eps);
+}
+
+
+const std::vector<unsigned int>& hmat::get_index_set(void)
+{
+	return idx_set;
+}
+
+unsigned int hmat::n_blocks(void)
+{
+	return blocks.size();
+}
+
+supermat* hmat::get_block(unsigned int i)
+{
+	return &blocks[i];
+}
+
+// gather: x_p(i) = x(idx_set[i])
+void hmat::to_reordered(const Eigen::VectorXd& x, Eigen::VectorXd& x_p)
+{
+	if(idx_set.empty())
+	{
+		x_p = x;
+		return;
+	}
+	x_p.resize(idx_set.size());
+	for(unsigned int i=0;i<idx_set.size();i++)
+		x_p(i) = x(idx_set[i]);
+}
+
+// scatter: x(idx_set[i]) = x_p(i)
+void hmat::to_original(const Eigen::VectorXd& x_p, Eigen::VectorXd& x)
+{
+	if(idx_set.empty())
+	{
+		x = x_p;
+		return;
+	}
+	x.resize(idx_set.size());
+	for(unsigned int i=0;i<idx_set.size();i++)
+		x(idx_set[i]) = x_p(i);
+}
+
+// H-Matrix-vector product
+void hmat::apply(const Eigen::VectorXd& x, Eigen::VectorXd& y, double alpha, double beta)
+{
+	// an empty H-Matrix (default constructed) is the zero matrix
+	if(blocks.empty())
+	{
+		if(beta==0.0)
+			y.setZero();
+		else
+			y *= beta;
+		return;
+	}
+	// permute the input vector to the ordering of the reordered matrix
+	Eigen::VectorXd x_p;
+	to_reordered(x, x_p);
+	Eigen::VectorXd y_p = Eigen::VectorXd::Zero(blocks[0].rows);
+
+	// linear scan over the blocks; every leaf adds its contribution to the rows of its block
+	for(unsigned int b=0;b<blocks.size();b++)
+	{
+		supermat* current_block = &blocks[b];
+
+		if(current_block->type==1 || current_block->type==2)
+		{
+			apply_leaf(current_block, x_p, y_p, 0);
+		}
+		else if(current_block->type==3)
+		{
+			// internal node: the children are blocks of their own
+		}
+		else if(current_block->type==4)
+		{
+			// zero block: nothing to add
+		}
+		else
+		{
+			std::cout<<"Error in apply: unknown type of matrix block!"<<std::endl;
+			return;
+		}
+	}
+
+	// permute the result back to the original ordering
+	if(beta==0.0)
+		y = Eigen::VectorXd::Zero(blocks[0].rows);
+	else
+		y = beta*y;
+	if(idx_set.empty())
+		y += alpha*y_p;
+	else
+	{
+		for(int i=0;i<blocks[0].rows;i++)
+			y(idx_set[i]) += alpha*y_p(i);
+	}
+}
+
+// H-Matrix product with multiple right hand sides
+void hmat::apply(const Eigen::MatrixXd& X, Eigen::MatrixXd& Y, double alpha, double beta)
+{
+	// an empty H-Matrix (default constructed) is the zero matrix
+	if(blocks.empty())
+	{
+		if(beta==0.0)
+			Y.setZero();
+		else
+			Y *= beta;
+		return;
+	}
+	int n = blocks[0].cols;
+	Eigen::MatrixXd X_p(n,X.cols());
+	if(idx_set.empty())
+		X_p = X;
+	else
+	{
+		for(int i=0;i<n;i++)
+			X_p.row(i) = X.row(idx_set[i]);
+	}
+	Eigen::MatrixXd Y_p = Eigen::MatrixXd::Zero(blocks[0].rows,X.cols());
+
+	for(unsigned int b=0;b<blocks.size();b++)
+	{
+		supermat* current_block = &blocks[b];
+
+		if(current_block->type==1 || current_block->type==2)
+		{
+			apply_leaf(current_block, X_p, Y_p, 0);
+		}
+		else if(current_block->type==3)
+		{
+			// internal node: the children are blocks of their own
+		}
+		else if(current_block->type==4)
+		{
+			// zero block: nothing to add
+		}
+		else
+		{
+			std::cout<<"Error in apply: unknown type of matrix block!"<<std::endl;
+			return;
+		}
+	}
 
-    std::sort(arr,arr+vec.size(),custom_sort);
+	if(beta==0.0)
+		Y = Eigen::MatrixXd::Zero(blocks[0].rows,X.cols());
+	else
+		Y = beta*Y;
+	if(idx_set.empty())
+		Y += alpha*Y_p;
+	else
+	{
+		for(int i=0;i<blocks[0].rows;i++)
+			Y.row(idx_set[i]) += alpha*Y_p.row(i);
+	}
+}
 
-    int j=0;
-    int next_idx=-100;
+// transposed H-Matrix-vector product
+void hmat::apply_transpose(const Eigen::VectorXd& x, Eigen::VectorXd& y, double alpha, double beta)
+{
+	// an empty H-Matrix (default constructed) is the zero matrix
+	if(blocks.empty())
+	{
+		if(beta==0.0)
+			y.setZero();
+		else
+			y *= beta;
+		return;
+	}
+	// the matrix is reordered symmetrically, so rows and cols share the same index set
+	Eigen::VectorXd x_p;
+	to_reordered(x, x_p);
+	Eigen::VectorXd y_p = Eigen::VectorXd::Zero(blocks[0].cols);
 
-    while(1)
+	for(unsigned int b=0;b<blocks.size();b++)
+	{
+		supermat* current_block = &blocks[b];
+
+		if(current_block->type==1)
+		{
+			// rk block: b*(a^T x)
+			y_p.segment(current_block->start_col,current_block->cols).noalias() += factor_b(current_block)*(factor_a(current_block).transpose()*x_p.segment(current_block->start_row,current_block->rows));
+		}
+		else if(current_block->type==2)
+		{
+			// full block
+			y_p.segment(current_block->start_col,current_block->cols) += full_block(current_block).transpose()*x_p.segment(current_block->start_row,current_block->rows);
+		}
+		else if(current_block->type==3)
+		{
+			// internal node: the children are blocks of their own
+		}
+		else if(current_block->type==4)
+		{
+			// zero block: nothing to add
+		}
+		else
+		{
+			std::cout<<"Error in apply_transpose: unknown type of matrix block!"<<std::endl;
+			return;
+		}
+	}
+
+	if(beta==0.0)
+		y = Eigen::VectorXd::Zero(blocks[0].cols);
+	else
+		y = beta*y;
+	if(idx_set.empty())
+		y += alpha*y_p;
+	else
+	{
+		for(int i=0;i<blocks[0].cols;i++)
+			y(idx_set[i]) += alpha*y_p(i);
+	}
+}
+
+// multi-threaded H-Matrix-vector product
+void hmat::apply_parallel(const Eigen::VectorXd& x, Eigen::VectorXd& y, double alpha, double beta, int n_threads)
+{
+	// an empty H-Matrix (default constructed) is the zero matrix
+	if(blocks.empty())
+	{
+		if(beta==0.0)
+			y.setZero();
+		else
+			y *= beta;
+		return;
+	}
+	if(n_threads<=0)
+	{
+#ifdef _OPENMP
+		n_threads = omp_get_max_threads();
+#else
+		n_threads = 1;
+#endif
+	}
+	if(int(leaf_part.size())!=n_threads+1)
+		flatten_leaves(n_threads);
+
+	Eigen::VectorXd x_p;
+	to_reordered(x, x_p);
+
+	// private accumulators: thread 't' only touches rows [row_lo[t], row_hi[t])
+	std::vector<Eigen::VectorXd> y_t(n_threads);
+	std::vector<int> row_lo(n_threads,0), row_hi(n_threads,0);
+
+	#pragma omp parallel for num_threads(n_threads) schedule(static,1)
+	for(int t=0;t<n_threads;t++)
+	{
+		int first = leaf_part[t];
+		int last = leaf_part[t+1];
+		if(first==last)
+			continue;
+		// leaves are sorted by start_row, so the row range of this sequence is known up front
+		int lo = leaves[first]->start_row;
+		int hi = lo;
+		for(int l=first;l<last;l++)
+			hi = std::max(hi, leaves[l]->start_row + leaves[l]->rows);
+		row_lo[t] = lo;
+		row_hi[t] = hi;
+		y_t[t] = Eigen::VectorXd::Zero(hi-lo);
+		for(int l=first;l<last;l++)
+			apply_leaf(leaves[l], x_p, y_t[t], lo);
+	}
+
+	// sum the partial results
+	Eigen::VectorXd y_p = Eigen::VectorXd::Zero(blocks[0].rows);
+	for(int t=0;t<n_threads;t++)
+	{
+		if(row_hi[t]>row_lo[t])
+			y_p.segment(row_lo[t],row_hi[t]-row_lo[t]) += y_t[t];
+	}
+
+	if(beta==0.0)
+		y = Eigen::VectorXd::Zero(blocks[0].rows);
+	else
+		y = beta*y;
+	if(idx_set.empty())
+		y += alpha*y_p;
+	else
+	{
+		for(int i=0;i<blocks[0].rows;i++)
+			y(idx_set[i]) += alpha*y_p(i);
+	}
+}
+
+// collects the leaves of the H-Matrix sorted by block offset
+void hmat::collect_leaves(void)
+{
+	if(!leaves.empty())
+		return;
+	for(unsigned int b=0;b<blocks.size();b++)
+	{
+		supermat* current_block = &blocks[b];
+		if(current_block->type==1 || current_block->type==2)
+			leaves.push_back(current_block);
+	}
+	std::sort(leaves.begin(),leaves.end(),leaf_sort);
+}
+
+// recompression of all rk blocks: QR of both factors and truncated SVD of the small core
+void hmat::recompress(double tol)
+{
+	collect_leaves();
+	std::vector<supermat*> rk_leaves;
+	for(std::vector<supermat*>::iterator itr=leaves.begin();itr!=leaves.end();++itr)
+	{
+		if((*itr)->type==1 && (*itr)->r->kt>0)
+			rk_leaves.push_back(*itr);
+	}
+
+	#pragma omp parallel for schedule(dynamic)
+	for(int l=0;l<int(rk_leaves.size());l++)
+	{
+		rkmat* rk = rk_leaves[l]->r;
+		if(rk->mapped_a!=NULL)
+		{
+			// the factors are rewritten, so a block of a loaded H-Matrix gets its own copy
+			rk->a = factor_a(rk_leaves[l]);
+			rk->b = factor_b(rk_leaves[l]);
+			rk->mapped_a = NULL;
+			rk->mapped_b = NULL;
+		}
+		int k = rk->kt;
+		int n_rows = rk->a.rows();
+		int n_cols = rk->b.rows();
+
+		// a = Q_a*R_a and b = Q_b*R_b, so a*b^T = Q_a*(R_a*R_b^T)*Q_b^T
+		Eigen::HouseholderQR<Eigen::MatrixXd> qr_a(rk->a);
+		Eigen::HouseholderQR<Eigen::MatrixXd> qr_b(rk->b);
+		Eigen::MatrixXd R_a = qr_a.matrixQR().topRows(k).triangularView<Eigen::Upper>();
+		Eigen::MatrixXd R_b = qr_b.matrixQR().topRows(k).triangularView<Eigen::Upper>();
+		Eigen::JacobiSVD<Eigen::MatrixXd> svd(R_a*R_b.transpose(), Eigen::ComputeFullU | Eigen::ComputeFullV);
+		const Eigen::VectorXd& sigma = svd.singularValues();
+
+		// smallest rank for which the dropped singular values stay below 'tol' relative to the Frobenius norm of the block
+		double total = sigma.squaredNorm();
+		double dropped = 0.0;
+		int new_rank = k;
+		while(new_rank>0 && dropped + sigma(new_rank-1)*sigma(new_rank-1) <= tol*tol*total)
+		{
+			dropped += sigma(new_rank-1)*sigma(new_rank-1);
+			new_rank--;
+		}
+
+		Eigen::MatrixXd Q_a = qr_a.householderQ()*Eigen::MatrixXd::Identity(n_rows,k);
+		Eigen::MatrixXd Q_b = qr_b.householderQ()*Eigen::MatrixXd::Identity(n_cols,k);
+		rk->a.noalias() = Q_a*(svd.matrixU().leftCols(new_rank)*sigma.head(new_rank).asDiagonal());
+		rk->b.noalias() = Q_b*svd.matrixV().leftCols(new_rank);
+		rk->kt = new_rank;
+	}
+
+	// the costs of the leaves changed, so the thread partition has to be recomputed
+	leaf_part.clear();
+}
+
+// collects the leaves and partitions them into sequences of balanced cost
+void hmat::flatten_leaves(int n_threads)
+{
+	collect_leaves();
+
+	double total_cost = 0.0;
+	std::vector<double> prefix_cost(leaves.size()+1,0.0);
+	for(unsigned int l=0;l<leaves.size();l++)
+	{
+		total_cost += leaf_cost(leaves[l]);
+		prefix_cost[l+1] = total_cost;
+	}
+
+	// thread 't' gets the leaves whose prefix cost falls into [t*total/n_threads, (t+1)*total/n_threads)
+	leaf_part.assign(n_threads+1,0);
+	unsigned int l=0;
+	for(int t=1;t<n_threads;t++)
+	{
+		double target = total_cost*t/n_threads;
+		while(l<leaves.size() && prefix_cost[l+1]<=target)
+			l++;
+		leaf_part[t] = l;
+	}
+	leaf_part[n_threads] = leaves.size();
+}
+
+void apply_leaf(supermat* block, const Eigen::VectorXd& x_p, Eigen::VectorXd& y_p, int row_offset)
+{
+	if(block->type==1)
+	{
+		// rk block: a*(b^T x)
+		y_p.segment(block->start_row-row_offset,block->rows).noalias() += factor_a(block)*(factor_b(block).transpose()*x_p.segment(block->start_col,block->cols));
+	}
+	else if(block->type==2)
+	{
+		// full block
+		y_p.segment(block->start_row-row_offset,block->rows) += full_block(block)*x_p.segment(block->start_col,block->cols);
+	}
+}
+
+void apply_leaf(supermat* block, const Eigen::MatrixXd& X_p, Eigen::MatrixXd& Y_p, int row_offset)
+{
+	if(block->type==1)
+	{
+		// rk block: two GEMMs, T = b^T X is a small (rank x n_rhs) matrix, then Y += a*T
+		Eigen::MatrixXd T(block->r->kt,X_p.cols());
+		T.noalias() = factor_b(block).transpose()*X_p.middleRows(block->start_col,block->cols);
+		Y_p.middleRows(block->start_row-row_offset,block->rows).noalias() += factor_a(block)*T;
+	}
+	else if(block->type==2)
+	{
+		// full block: sparse times dense
+		Y_p.middleRows(block->start_row-row_offset,block->rows).noalias() += full_block(block)*X_p.middleRows(block->start_col,block->cols);
+	}
+}
+
+Eigen::Map<const Eigen::MatrixXd> factor_a(const supermat* block)
+{
+	const rkmat* rk = block->r;
+	return Eigen::Map<const Eigen::MatrixXd>(rk->mapped_a!=NULL ? rk->mapped_a : rk->a.data(), block->rows, rk->kt);
+}
+
+Eigen::Map<const Eigen::MatrixXd> factor_b(const supermat* block)
+{
+	const rkmat* rk = block->r;
+	return Eigen::Map<const Eigen::MatrixXd>(rk->mapped_b!=NULL ? rk->mapped_b : rk->b.data(), block->cols, rk->kt);
+}
+
+Eigen::Map<const Eigen::SparseMatrix<double> > full_block(const supermat* block)
+{
+	const fullmat* f = block->f;
+	if(f->m==NULL)
+		return Eigen::Map<const Eigen::SparseMatrix<double> >(block->rows, block->cols, f->mapped_col_ptr[block->cols], f->mapped_col_ptr, f->mapped_row_idx, f->mapped_values);
+	return Eigen::Map<const Eigen::SparseMatrix<double> >(block->rows, block->cols, f->m->nonZeros(), f->m->outerIndexPtr(), f->m->innerIndexPtr(), f->m->valuePtr(), f->m->innerNonZeroPtr());
+}
+
+double leaf_cost(supermat* block)
+{
+	if(block->type==1)
+		return double(block->r->kt)*(block->rows + block->cols);
+	else if(block->type==2)
+		return double(full_block(block).nonZeros());
+	return 0.0;
+}
+
+bool task_sort(supermat* s1, supermat* s2)
+{
+	return double(s1->rows)*s1->cols > double(s2->rows)*s2->cols;
+}
+
+bool leaf_sort(supermat* s1, supermat* s2)
+{
+	if(s1->start_row!=s2->start_row)
+		return s1->start_row < s2->start_row;
+	return s1->start_col < s2->start_col;
+}
+
+int find_index(const Eigen::VectorXd& vec, std::vector<bool>& used)
+{
+    int next_idx=-1;
+    double dum_max=-1.0;
+    for(int i=0;i<vec.size();i++)
     {
-        if(std::find(collected_idx.begin(),collected_idx.end(),arr[j].idx) == collected_idx.end())
+        if(!used[i] && std::abs(vec(i))>dum_max)
         {
-            next_idx = arr[j].idx;
-            break;
+            dum_max = std::abs(vec(i));
+            next_idx = i;
         }
-        else
-            j=j+1;
     }
-    if (next_idx<0)
-        std::cout<<"Error in find_index algorithm."<<std::endl;
     return next_idx;
-
-}
-
-bool custom_sort(struct new_el e1, struct new_el e2)
-{
-    return e1.val > e2.val;
 }
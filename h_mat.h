@@ -1,13 +1,17 @@
 // class for H-Matrix
 // 3 structs: a) R-k Matrix b) Full Matrix c) SuperMatrix
 //! This class can be used for a block cluster tree.
+// the rk blocks are compressed with the cross approximation (ACA+); compile with -DHMAT_USE_RSVD to use the randomized SVD instead
 #ifndef HMAT_H
 #define HMAT_H
 
 #include <Eigen/Dense>
 #include <Eigen/SparseCore>
 #include <vector>
+#include <string>
 #include "block_cluster.h"
+#include "arena.h"
+#include "matrix_io.h"
 
 /// Three structs for handling the blocks during the partition process. The structs are described below:
 /// rkmat: used for handling R-K Matrix blocks.
@@ -17,58 +21,168 @@
 ///rkmat:
 /// k: expected rank of rk block (same as input rank 'r').
 /// kt: rank of the rk block
-/// a: stores the column vectors.
-/// b: stores the row vectors.
-/// Note: both 'a' and 'b' are stored as row vectors (due to some error in Eigen library). Care to be taken when performing operations on rk blocks.
+/// a: (rows x kt) matrix holding the column vectors.
+/// b: (cols x kt) matrix holding the row vectors; the block is approximated by a*b^T.
+/// Note: both factors are column-major and each is one contiguous allocation, aligned by Eigen for the enabled vector instruction set (32 bytes with AVX, 64 with AVX-512).
+/// mapped_a, mapped_b: for a block of an H-Matrix read by 'hmat::load', the factors in the mapped file ('a' and 'b' are then empty); NULL otherwise.
 struct rkmat
 {
 	int k;
 	int kt;
-	std::vector<Eigen::VectorXd > a;
-	std::vector<Eigen::VectorXd > b;
+	Eigen::MatrixXd a;
+	Eigen::MatrixXd b;
+	const double* mapped_a;
+	const double* mapped_b;
 };
 
 ///fullmat:
 /// Eigen sparse matrix for holding dense blocks
+/// For a block of an H-Matrix read by 'hmat::load', 'm' is NULL and the block is the compressed column storage in the mapped file.
 struct fullmat
 {
 	Eigen::SparseMatrix<double>* m;
+	const int* mapped_col_ptr;
+	const int* mapped_row_idx;
+	const double* mapped_values;
 };
 
 struct supermat
 {
-	int type; // 1 == rk- matrix; 2 == full matrix; 3 == supermatrix (internal node)
+	int type; // 1 == rk- matrix; 2 == full matrix; 3 == supermatrix (internal node); 4 == zero matrix (admissible block without entries, nothing is stored)
 	int rows,cols; // rows and cols of this supermatrix
-	// depending on the type, other two pointers are set to NULL
+	int start_row,start_col; // offset of this block in the reordered matrix
+	// depending on the type, other two pointers are set to NULL; the objects belong to the pools of the hmat
 	rkmat* r;
 	fullmat* f;
-	std::vector<supermat*> s; // contains children of a particular node
+	unsigned int first_child,n_child; // the children are stored contiguously in the block array of the hmat
 };
 
-/// Helper for custom_sort. Tracks the original index of the element after sorting the array.
-struct new_el
+///sparse_block:
+/// View of a block of a sparse matrix for the cross approximation. Single rows and columns of the block are read from a row compressed (csr) and a column compressed (csc) copy of the matrix, so the block is never densified.
+struct sparse_block
 {
-    double val;
-    int idx;
+	Eigen::SparseMatrix<double>* csc;
+	Eigen::SparseMatrix<double,Eigen::RowMajor>* csr;
+	int start_row,start_col; // offset of the block in the matrix
+	int n_rows,n_cols;
+	int rows(void);
+	int cols(void);
+	/// Adds row 'i' of the block to the dense vector 'v'; only the entries of the row are touched.
+	void add_row(int i, Eigen::VectorXd& v);
+	/// Adds column 'j' of the block to the dense vector 'v'.
+	void add_col(int j, Eigen::VectorXd& v);
+	/// Appends the rows of the block which hold entries to 'v'.
+	void nonempty_rows(std::vector<int>& v);
+	/// Appends the columns of the block which hold entries to 'v'.
+	void nonempty_cols(std::vector<int>& v);
+	/// Squared Frobenius norm of the block.
+	double squared_norm(void);
+	/// <B,a*b^T> over the entries of the block, using the first 'q' columns of 'a' and 'b'. 'i_max' and 'j_max' get the entry with the largest |B-a*b^T|
+	/// whose row and column are not marked in 'used_rows' and 'used_cols' (-1 if there is none).
+	double residual_dot(const Eigen::MatrixXd& a, const Eigen::MatrixXd& b, int q, std::vector<bool>& used_rows, std::vector<bool>& used_cols, int& i_max, int& j_max);
+	/// Copies the whole block into the sparse matrix 'b'.
+	void get_block(Eigen::SparseMatrix<double>& b);
 };
 
 /// The class contains a pointer to the root of the block cluster tree and consequently, the H-Matrix is constructed by recursively traveling down the block cluster tree.
 class hmat
 {
 private:
-	supermat* root;
+	std::vector<supermat> blocks; // all blocks in BFS order, in the same order as the nodes of the block cluster tree; blocks[0] is the root
+	std::vector<unsigned int> idx_set; // index set from tree::map_index; row 'i' of the reordered matrix is row 'idx_set[i]' of the original matrix
+	double eps; // relative accuracy of the rk blocks; 0 means every rk block is built with the fixed rank 'r'
+	std::vector<supermat*> leaves; // rk and full leaves sorted by block offset; filled once by 'flatten_leaves'
+	std::vector<int> leaf_part; // leaves[leaf_part[t]] ... leaves[leaf_part[t+1]-1] are applied by thread 't'
+	// the leaf objects are allocated from pools owned by the hmat and released together with it
+	arena<rkmat> rk_pool;
+	arena<fullmat> full_pool;
+	arena<Eigen::SparseMatrix<double> > sparse_pool;
+	mapped_file file; // file read by 'load', which the leaves refer to; closed when the H-Matrix is rebuilt or loaded again
+	/// Collects the rk and full leaves of the H-Matrix into 'leaves'.
+	void collect_leaves(void);
+	/// Collects the leaves of the H-Matrix and splits them into 'n_threads' sequences of balanced cost.
+	void flatten_leaves(int n_threads);
+	/// Extracts all leaves from the matrix in one pass over its entries, in parallel over strips of columns: dense blocks are copied, rk blocks without entries are marked as zero blocks.
+	/// Costs O(nnz + #leaves) apart from locating the leaf of an entry within its strip, which is O(1) for consecutive entries of the same leaf.
+	void extract_leaves(std::vector<supermat*>&, Eigen::SparseMatrix<double>*);
+	/// Fills one rk leaf during construction by cross approximation of its block.
+	void build_leaf(supermat*, Eigen::SparseMatrix<double>*, Eigen::SparseMatrix<double,Eigen::RowMajor>*, int);
 public:
 	hmat();
 	/// Custom constructor which uses block cluster tree and matrix to build the H-Matrix.
 	hmat(bctree&, Eigen::SparseMatrix<double>*, int);
-	/// Helper function for constructing H-Matrix. We traverse the block cluster tree and mark each node as R-K, Full or Super matrix.
+	/// Custom constructor which also stores the index set used to reorder the matrix, so that 'apply' works in the original ordering.
+	/// If 'eps' is positive the rank of every rk block is chosen adaptively up to the relative accuracy 'eps', and 'r' is only an upper bound for the rank.
+	hmat(bctree&, Eigen::SparseMatrix<double>*, int, std::vector<unsigned int>&, double eps=0.0);
+	/// Helper function for constructing H-Matrix. We scan the block cluster tree and mark each node as R-K, Full or Super matrix; block 'i' of the H-Matrix is node 'i' of the block cluster tree.
+	/// The leaves are extracted from the matrix in one pass; the rk leaves are then compressed as independent tasks in parallel, largest blocks first
+	/// (with -DHMAT_USE_RSVD, by the batched randomized SVD). Returns the root block.
 	supermat* create_hmat(bctree&, Eigen::SparseMatrix<double>*, int);
-	void CA_partial_pivot(Eigen::MatrixXd&, rkmat*, int);
+	/// Cross Approximation with ACA+ pivoting. Stops at rank 'r', or once the exact residual satisfies ||B-S_k||_F <= eps*||B||_F (zero up to rounding if 'eps' is 0).
+	/// The residual is computed over the entries of the block when the references show a zero residual or, with positive 'eps', when ||a_k||*||b_k|| <= eps*||S_k||_F.
+	/// If it is too large, the entry with the largest residual becomes the next pivot.
+	void CA_partial_pivot(Eigen::MatrixXd&, rkmat*, int r, double eps=0.0);
+	/// Cross Approximation of a block of a sparse matrix; the references are taken only from the non-empty rows and columns, and only the rows and columns used
+	/// as references or pivots are read. Apart from one O((rows+cols)*log(nnz)) scan for the non-empty rows and columns and O(nnz*k) per exact
+	/// residual check, the cost is O(k*(rows+cols)) instead of O(rows*cols).
+	void CA_partial_pivot(sparse_block&, rkmat*, int r, double eps=0.0);
+	/// Randomized SVD of a block of a sparse matrix: randomized range finder with power iterations, using only products of the sparse block with thin dense matrices.
+	/// Produces the same 'rk' output as the cross approximation, with rank at most 'r' and, if 'eps' is positive, the smallest rank reaching the relative accuracy 'eps'.
+	void RSVD(sparse_block&, rkmat*, int r, double eps=0.0);
+	/// Randomized SVD of many blocks at once, with the same results as above: the blocks with the same number of samples are the diagonal blocks of one sparse matrix,
+	/// so every product with a block is one parallel sparse product for all of them; only the small QR and SVD factorizations are done block by block.
+	void RSVD(std::vector<sparse_block>&, std::vector<rkmat*>&, int r, double eps=0.0);
+	/// Recompresses every rk block: both factors are QR-factorized and the small core R_a*R_b^T is truncated by SVD to the relative accuracy 'tol'.
+	/// The factors are rewritten in place and 'kt' is updated; the block structure does not change. The blocks are processed in parallel.
+	void recompress(double tol);
+	/// Writes the H-Matrix to a binary file: the flattened block array, the index set, the rk factors as one contiguous array and the full blocks in CSC.
+	/// Returns false (with a message on the console) if the file cannot be written.
+	bool save(const std::string& filename);
+	/// Replaces the H-Matrix by the one in a file written by 'save'; neither the matrix nor the block cluster tree is needed. The file stays mapped and the leaves
+	/// refer to the rk factors and full blocks in it, so nothing is parsed or copied: apart from the validation of the file, loading only fills the block array,
+	/// and the pages of the leaves are read on first use. 'recompress' copies the rk blocks it rewrites.
+	/// The file must not be changed or truncated while the H-Matrix is in use (write a new file and rename it instead). Returns false (with a message on the console) if the file is not valid.
+	bool load(const std::string& filename);
+	/// Memory held by the H-Matrix in bytes: block array, leaf objects, rk factors and entries of the full blocks. Leaves in a file mapped by 'load' are not included.
+	std::size_t memory_usage(void);
+	/// Index set of the reordering (the permutation from 'tree::map_index'); empty if the matrix was not reordered.
+	const std::vector<unsigned int>& get_index_set(void);
+	/// Number of blocks in the block array (internal nodes and leaves); block 0 is the root.
+	unsigned int n_blocks(void);
+	/// Returns a pointer to block 'i' of the block array.
+	supermat* get_block(unsigned int i);
+	/// Maps a vector from the ordering of the original matrix to the ordering of the H-Matrix: x_p(i) = x(idx_set[i]).
+	void to_reordered(const Eigen::VectorXd& x, Eigen::VectorXd& x_p);
+	/// Maps a vector from the ordering of the H-Matrix back to the ordering of the original matrix: x(idx_set[i]) = x_p(i).
+	void to_original(const Eigen::VectorXd& x_p, Eigen::VectorXd& x);
+	/// H-Matrix-vector product: y = alpha*H*x + beta*y. 'x' and 'y' are in the ordering of the original matrix.
+	/// An empty H-Matrix (default constructed) is the zero matrix: all products only scale 'y' by 'beta'.
+	void apply(const Eigen::VectorXd& x, Eigen::VectorXd& y, double alpha=1.0, double beta=0.0);
+	/// Transposed H-Matrix-vector product: y = alpha*H^T*x + beta*y. 'x' and 'y' are in the ordering of the original matrix.
+	void apply_transpose(const Eigen::VectorXd& x, Eigen::VectorXd& y, double alpha=1.0, double beta=0.0);
+	/// Blocked H-Matrix product with several right hand sides: Y = alpha*H*X + beta*Y. Every leaf is applied to all columns of 'X' at once.
+	void apply(const Eigen::MatrixXd& X, Eigen::MatrixXd& Y, double alpha=1.0, double beta=0.0);
+	/// Multi-threaded version of 'apply'. The leaves are split into per-thread sequences of balanced cost (rank*(rows+cols) for rk blocks, nnz for full blocks).
+	/// Every thread accumulates into a private vector covering only its row range; the partial results are summed at the end. 'n_threads'<=0 uses all available threads.
+	void apply_parallel(const Eigen::VectorXd& x, Eigen::VectorXd& y, double alpha=1.0, double beta=0.0, int n_threads=0);
 };
 
 /// Helper function for Cross-Approximation partial pivoting algorithm.
-/// Finds the next row maximizer index based on the Partition set.
-int find_index(Eigen::VectorXd&, std::vector<int>&);
-bool custom_sort(struct new_el, struct new_el);
+/// Returns the index of the entry of largest magnitude among the indices not yet used as pivots; negative if all indices are used.
+int find_index(const Eigen::VectorXd&, std::vector<bool>&);
+/// Helper for 'apply'. Adds the product of the leaf block with 'x_p' to 'y_p'; 'row_offset' is the first row of the reordered matrix held by 'y_p'.
+void apply_leaf(supermat*, const Eigen::VectorXd& x_p, Eigen::VectorXd& y_p, int row_offset);
+void apply_leaf(supermat*, const Eigen::MatrixXd& X_p, Eigen::MatrixXd& Y_p, int row_offset);
+/// Factors 'a' (rows x kt) and 'b' (cols x kt) of an rk block, in its own storage or in the mapped file.
+Eigen::Map<const Eigen::MatrixXd> factor_a(const supermat*);
+Eigen::Map<const Eigen::MatrixXd> factor_b(const supermat*);
+/// Matrix of a full block, in its own storage or in the mapped file.
+Eigen::Map<const Eigen::SparseMatrix<double> > full_block(const supermat*);
+/// Estimated cost of applying a leaf block: rank*(rows+cols) for rk blocks and nnz for full blocks.
+double leaf_cost(supermat*);
+/// Helper for ordering the construction tasks by block size, largest first.
+bool task_sort(supermat*, supermat*);
+/// Helper for sorting leaves by their block offset.
+bool leaf_sort(supermat*, supermat*);
 
 #endif
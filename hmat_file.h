@@ -0,0 +1,45 @@
+/// \file hmat_file.h
+/// \brief Layout of the binary H-Matrix file written by 'hmat::save' and mapped by 'hmat::load'.
+
+#ifndef HMAT_FILE_H
+#define HMAT_FILE_H
+
+#include <stdint.h>
+#include <cstddef>
+
+/// Header of the binary H-Matrix file. It is followed by the block records, the index set and the sections of the rk values,
+/// the column pointers, the row indices and the values of the full blocks; every section after the index set starts at a multiple of 8 bytes.
+struct hmat_file_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	double eps;
+	int64_t n_blocks;
+	int64_t n_idx; // size of the index set
+	int64_t n_rk_values; // values of all rk factors
+	int64_t n_col_ptr; // column pointers of all full blocks
+	int64_t n_entries; // entries of all full blocks
+};
+
+/// One block of the binary H-Matrix file, in the order of the block array.
+struct hmat_file_block
+{
+	int32_t type, rows, cols, start_row, start_col;
+	uint32_t first_child, n_child;
+	int32_t k, kt;
+	int32_t reserved;
+	int64_t offset; // rk: first value of 'a' in the rk section, 'b' follows; full: first column pointer
+	int64_t entry_offset; // full: first entry in the row index and value sections
+};
+
+// the records are written and mapped as they are: the layout must not depend on the compiler
+static_assert(sizeof(hmat_file_header)==64, "hmat_file_header must be 64 bytes");
+static_assert(offsetof(hmat_file_header, version)==8 && offsetof(hmat_file_header, eps)==16, "hmat_file_header has padding");
+static_assert(offsetof(hmat_file_header, n_blocks)==24 && offsetof(hmat_file_header, n_entries)==56, "hmat_file_header has padding");
+static_assert(sizeof(hmat_file_block)==56, "hmat_file_block must be 56 bytes");
+static_assert(offsetof(hmat_file_block, rows)==4 && offsetof(hmat_file_block, first_child)==20, "hmat_file_block has padding");
+static_assert(offsetof(hmat_file_block, k)==28 && offsetof(hmat_file_block, kt)==32, "hmat_file_block has padding");
+static_assert(offsetof(hmat_file_block, offset)==40 && offsetof(hmat_file_block, entry_offset)==48, "hmat_file_block has padding");
+
+#endif
@@ -9,12 +9,11 @@
 #include <queue>
 #include <stack>
 #include <algorithm>
-#include <fstream>
-#include <sstream>
 #include "tree.h"
 #include "graph_cluster.h"
 #include "block_cluster.h"
 #include "h_mat.h"
+#include "matrix_io.h"
 
 using namespace Eigen;
 using namespace std;
@@ -22,29 +21,35 @@ using namespace std;
 typedef SparseMatrix<double> SpMat;
 typedef MatrixXd Mat;
 
-/// \brief This function inputs a matrix in '.csv' format.
-///
-/// \param Reference to the sparse matrix which holds the matix A
-/// \return void
-///
-///
-void input_matrix(SpMat&);
 /// \brief This function executes the graph coarsening process based on modified HEM algorithm.
 ///
 /// \param 'v' A vector of pointers to graph_cluster objects, which store the information about graphs at each step of the coarsening process.
 /// \param 'n_cols' Number of columns (/rows) in the matrix.
+/// \param 'parallel' Use the parallel handshake versions ('graph_cluster::priority_match_parallel', 'aggregate_match_parallel' and 'leaf_aggregate_parallel') instead of the serial
+/// matching and aggregation; the graphs do not depend on the number of threads.
+/// \param 'agg_size' Maximum number of vertices merged into one cluster per step. 2 uses heavy edge matching; larger values use k-way aggregation ('graph_cluster::aggregate_match'), which needs about log(n)/log(agg_size) levels instead of log2(n).
+/// \param 'leaf_size' If positive, the first step aggregates the matrix directly into leaf clusters of at most 'leaf_size' indices ('graph_cluster::leaf_aggregate'), so no graphs and tree levels below the leaf size are built.
 /// \return void
 ///
 //!< NOTE: The HEM algorithm is only applicable to symmetric systems.
-void generate_graphs(std::vector<graph_cluster*>&, int); // function for graph coarsening process
-/// \brief This function reorders the original input matrix ('A') as per the index set, using a permutation matrix.
+void generate_graphs(std::vector<graph_cluster*>&, int, bool parallel=false, int agg_size=2, int leaf_size=0); // function for graph coarsening process
+/// \brief This function reorders the original input matrix ('A') in place as per the index set: B(i,j) = A(idx_set[i],idx_set[j]).
+/// The permuted matrix is written by two counting passes over the entries, O(nnz+n); no permutation matrix, no sparse products and no sorting.
 ///
 /// \param 's1' the original matrix ('A')
 /// \param 'idx_set' the index set as computed from the index tree.
-/// \return void
+/// \return false (with a message on the console, 's1' unchanged) if the matrix is not square or 'idx_set' is not a permutation of its indices.
+///
 ///
+bool reorder_matrix(SpMat&, std::vector<unsigned int>&);
+/// \brief Same as above, reading the original matrix from a map (e.g. of a 'binary_matrix') and writing the reordered one to 's1', so the input is never copied.
+///
+/// \param 'a' the original matrix ('A')
+/// \param 'idx_set' the index set as computed from the index tree.
+/// \param 's1' the reordered matrix ('B')
+/// \return false (with a message on the console, 's1' unchanged) if the matrix is not square or 'idx_set' is not a permutation of its indices.
 ///
-void reorder_matrix(SpMat&, std::vector<unsigned int>&);
+bool reorder_matrix(const Map<const SpMat>&, std::vector<unsigned int>&, SpMat&);
 /// \brief This function creates the graphs again based on the reordered matrix. The process is not computationally intensive because priority groups need not be found again. This process is important because graphs will be needed while creating block cluster tree.
 ///
 /// \param 'graphs' vector containing graphs from previous coarsening process.
@@ -56,7 +61,9 @@ void reorder_graphs(std::vector<graph_cluster*>&, tree&);
 
 //void generate_block_cluster_tree(bct_node*, int, tree&, tree&, std::vector<graph_cluster*>&);
 
-int main()
+/// The matrix is read from the file given as first argument ('matrix.mtx' by default), either a Matrix Market file or a binary CSC file ('write_binary_matrix').
+/// If a second file name is given, the input matrix is also written to it in the binary format, so later runs skip the parsing.
+int main(int argc, char* argv[])
 {
 	// create dummy matrix for testing
 	//Mat m(6,6);
@@ -87,17 +94,29 @@ int main()
 	cout<<"Converting to sparse matrix!"<<endl;
 //	SpMat s1 = m.sparseView();
 	// convert dense matrix to sparse format
-	SpMat s1(804,804);
-	input_matrix(s1);
-    s1.cwiseAbs();
-	graph_cluster g1(&s1);
+	std::string filename = (argc>1) ? argv[1] : "matrix.mtx";
+	// a binary matrix stays mapped and is used in place until the reordering; a Matrix Market file is parsed into 's0'
+	binary_matrix bm;
+	SpMat s0;
+	bool binary = is_binary_matrix(filename);
+	if(binary ? !bm.open(filename) : !read_matrix_market(filename, s0))
+		return 1;
+	Map<const SpMat> a = binary ? bm.matrix() : sparse_map(s0);
+	if(binary)
+		cout<<"Input success: Matrix dimensions "<<a.rows()<<","<<a.cols()<<", entries "<<a.nonZeros()<<endl;
+	if(argc>2 && !write_binary_matrix(argv[2], a))
+		return 1;
+	graph_cluster g1(a);
 
 	//coarsening process starts here
 	cout<<"Graph coarsening started. Step 1"<<endl;
 	std::vector<graph_cluster*> graphs;
 	graphs.push_back(&g1);
 	cout<<"Graph coarsening process. Step 2"<<endl;
-	generate_graphs(graphs,s1.cols());
+	bool parallel_match = true; // handshake matching and aggregation, parallel on every level
+	int agg_size = 4; // vertices merged into one cluster per coarsening step; 2 is pairwise matching
+	int leaf_size = 80; // clusters up to this size are not split further
+	generate_graphs(graphs,a.cols(),parallel_match,agg_size,leaf_size);
 	std::cout<<"Graph coarsening completed. Step 3"<<std::endl;
 	// coarsening process completes here
 
@@ -121,11 +140,32 @@ int main()
 
 	cout<<"-----------------------------------------------------"<<endl;
 	// permute the matrix as per the index set
-	reorder_matrix(s1,idx_set);
+	SpMat s1;
+	if(!reorder_matrix(a,idx_set,s1))
+	{
+		for(unsigned int i=1;i<graphs.size();i++)
+		{
+			delete graphs[i]->get_matrix();
+			delete graphs[i];
+		}
+		return 1;
+	}
 	cout<<"Reordering of matrix completed."<<endl;
+	// the input graph is the reordered matrix from now on; the input itself ('a') is not needed any more
+	g1.set_matrix(&s1);
+	bm.close();
+	SpMat().swap(s0);
 	//cout<<MatrixXd(s1)<<endl;
 	cout<<"-----------------------------------------------------"<<endl;
 
+	//update binary index so that cluster and binary index tree are stored in same object
+	cout<<"-----------------------------------------------------"<<endl;
+	cout<<"Index Tree created."<<endl;
+	// 'bt_idx' numbers the nodes of every level; needed by 'reorder_graphs'
+	bt.update_bt_idx();
+	//bt.index_tree(); // prints the index tree to console
+	cout<<"-----------------------------------------------------"<<endl;
+
 	cout<<"-----------------------------------------------------"<<endl;
 	// generate graphs from reordered matrix
 	reorder_graphs(graphs, bt);
@@ -137,26 +177,17 @@ int main()
 //	cout<<endl;
 	cout<<"-----------------------------------------------------"<<endl;
 
-	//update binary index so that cluster and binary index tree are stored in same object
-	cout<<"-----------------------------------------------------"<<endl;
-	cout<<"Index Tree created."<<endl;
-	// creating cluster tree
-	bt.update_bt_idx();
-	//bt.index_tree(); // prints the index tree to console
-	cout<<"-----------------------------------------------------"<<endl;
-
 
 	cout<<"-----------------------------------------------------"<<endl;
 	cout<<"Cluster Tree created."<<endl;
 	// creating cluster tree
-	bt.cluster_tree(s1.cols());
+	bt.cluster_tree();
 	//cout<<bt;
 	cout<<"-----------------------------------------------------"<<endl;
 
 	cout<<"-----------------------------------------------------"<<endl;
 	cout<<"Block Cluster Tree created. "<<endl;
 	bctree bct;
-	int leaf_size = 80;
 	bct.block_cluster(bt, graphs, leaf_size);
 	//cout<<bct<<endl;
 	bct.output();
@@ -164,47 +195,23 @@ int main()
 
 	cout<<"-----------------------------------------------------"<<endl;
 	cout<<"H-Matrix successfully created. "<<endl;
-   	hmat hMatrix(bct, &s1, 1);
+	int max_rank = 50; // upper bound for the rank of the rk blocks
+	double eps = 1e-6; // relative accuracy of the rk blocks
+   	hmat hMatrix(bct, &s1, max_rank, idx_set, eps);
+	hMatrix.recompress(eps);
+	cout<<"Memory: cluster tree "<<bt.memory_usage()<<" B, block cluster tree "<<bct.memory_usage()<<" B, H-Matrix "<<hMatrix.memory_usage()<<" B"<<endl;
    	cout<<"-----------------------------------------------------"<<endl;
-}
-
-void input_matrix(SpMat& sm)
-{
-    ifstream ip("matrix.csv");
-
-    if(!ip.is_open()) cout<<"Error: file open"<<endl;
-
-    int row, col;
-    double val;
-    string line;
-    int line_n=1;
-    while(ip.good())
-    {
-        getline(ip,line);
-        //cout<<line_n<<endl;
-        istringstream ss(line);
-        string substr;
-        int i=0;
-        while(getline(ss,substr,'\t'))
-        {
-            if (i==0)
-                row= stoi(substr)-1;
-            else if(i==1)
-                col = stoi(substr)-1;
-            else if(i==2)
-                val = stod(substr);
-            i+=1;
-
-        }
-        sm.insert(row,col) = val;
-        line_n+=1;
-    }
 
-    std::cout<<"Input success: Matrix dimensions "<<sm.rows()<<","<<sm.cols()<<std::endl;
-    ip.close();
+	// the coarse graphs and their matrices were allocated by 'generate_graphs'; graphs[0] is the input graph
+	for(unsigned int i=1;i<graphs.size();i++)
+	{
+		delete graphs[i]->get_matrix();
+		delete graphs[i];
+	}
+	return 0;
 }
 
-void generate_graphs(std::vector<graph_cluster*>& v, int n_cols)
+void generate_graphs(std::vector<graph_cluster*>& v, int n_cols, bool parallel, int agg_size, int leaf_size)
 {
     //! PRE-PROCESSING: The input vector contains only the original matrix and no priority groups exists. So, the Index Set is split into two parts at the middle based on the number of rows (/cols). These groups serve as priority groups for the 1st iteration. The Priority Match algorithm is executed using these groups as input.
 	std::vector<unsigned int> gp1,gp2;
@@ -230,7 +237,18 @@ void generate_graphs(std::vector<graph_cluster*>& v, int n_cols)
 			gp2.push_back(i);
 		}
 	}
-	v.back()->priority_match(gp1,gp2);
+	if(leaf_size>0 && parallel)
+		v.back()->leaf_aggregate_parallel(leaf_size);
+	else if(leaf_size>0)
+		v.back()->leaf_aggregate(leaf_size);
+	else if(agg_size>2 && parallel)
+		v.back()->aggregate_match_parallel(gp1,gp2,agg_size);
+	else if(agg_size>2)
+		v.back()->aggregate_match(gp1,gp2,agg_size);
+	else if(parallel)
+		v.back()->priority_match_parallel(gp1,gp2);
+	else
+		v.back()->priority_match(gp1,gp2);
 	//cout<<*v.back();
 
 	std::vector<SpMat*> matrices;
@@ -241,10 +259,10 @@ void generate_graphs(std::vector<graph_cluster*>& v, int n_cols)
     //! convert_to_coarser_graph is used to compute the coarsened graph.
     //! Memory is allocated using the new operator for a new graph_cluster object.
     //! This object is added to the vector passed as an input to the generate_graphs function.
-	int n=0;
-	while(n!=2)
+    //! As singletons are paired ('graph_cluster::pair_singletons'), every step at least halves the number of vertices, so the loop ends after O(log n) steps.
+	int n=v.back()->get_n_clusters();
+	while(n>1)
 	{
-		n = v.back()->get_n_clusters(); // get number of clusters from the last graph
 		//cout<<"Graph Clustering Process Step 2. Number of nodes: "<<n<<endl;
 		SpMat* s = new SpMat(n,n); // initialize a new sparse matrix to store the next coarse graph
 		v.back()->convert_to_coarser_graph(*s); // computes the next coarse graph: in form of matrix
@@ -254,25 +272,79 @@ void generate_graphs(std::vector<graph_cluster*>& v, int n_cols)
 //            cout<<*s<<endl;
 		gp1 = v.back()->get_priority_group1();
 		gp2 = v.back()->get_priority_group2();
-		g->priority_match(gp1,gp2);
+		if(agg_size>2 && parallel)
+			g->aggregate_match_parallel(gp1,gp2,agg_size);
+		else if(agg_size>2)
+			g->aggregate_match(gp1,gp2,agg_size);
+		else if(parallel)
+			g->priority_match_parallel(gp1,gp2);
+		else
+			g->priority_match(gp1,gp2);
 		v.push_back(g);
+		n = g->get_n_clusters();
 		//cout<<*g;
 	}
 }
 
-void reorder_matrix(SpMat& s1, std::vector<unsigned int>& idx_set)
+bool reorder_matrix(SpMat& s1, std::vector<unsigned int>& idx_set)
 {
-	// generate permutation matrix
-	SpMat pMat(s1.cols(),s1.cols());
-	pMat.reserve(s1.cols());
-	int dum_ctr=0;
-	for(std::vector<unsigned int>::iterator itr=idx_set.begin();itr!=idx_set.end();++itr)
+	s1.makeCompressed();
+	SpMat p;
+	if(!reorder_matrix(sparse_map(s1), idx_set, p))
+		return false;
+	s1.swap(p);
+	return true;
+}
+
+bool reorder_matrix(const Map<const SpMat>& a, std::vector<unsigned int>& idx_set, SpMat& s1)
+{
+	// symmetric permutation: entry (idx_set[i],idx_set[j]) of the original matrix becomes entry (i,j)
+	// two counting passes, O(nnz+n) and no sorting: the entries are first scattered into the rows of a row major copy, taking the
+	// columns of the result in order, so the columns within every row come out sorted; the conversion back to column major is
+	// again a counting transpose, which leaves the rows within every column sorted
+	int n = a.cols();
+	if(int(idx_set.size())!=n || a.rows()!=n)
 	{
-		pMat.insert(dum_ctr,*itr) = 1;
-		dum_ctr+=1;
+		cout<<"Error in reorder_matrix: index set does not match the matrix!"<<endl;
+		return false;
 	}
-
-	s1 = pMat*s1*pMat.transpose();
+	std::vector<int> inv_set(n,-1); // position of every original index in the reordered matrix
+	for(int i=0;i<n;i++)
+	{
+		if(idx_set[i]>=(unsigned int)n || inv_set[idx_set[i]]>=0)
+		{
+			cout<<"Error in reorder_matrix: index set is not a permutation!"<<endl;
+			return false;
+		}
+		inv_set[idx_set[i]] = i;
+	}
+	const int* outer = a.outerIndexPtr();
+	const int* inner = a.innerIndexPtr();
+	const double* values = a.valuePtr();
+	Eigen::SparseMatrix<double,Eigen::RowMajor> p_rows(n,n);
+	int* p_outer = p_rows.outerIndexPtr();
+	// entries per row of the result
+	for(int k=0;k<outer[n];k++)
+		p_outer[inv_set[inner[k]]+1]++;
+	for(int i=0;i<n;i++)
+		p_outer[i+1] += p_outer[i];
+	p_rows.resizeNonZeros(p_outer[n]);
+	int* p_inner = p_rows.innerIndexPtr();
+	double* p_values = p_rows.valuePtr();
+	std::vector<int> pos(p_outer, p_outer+n); // next free position in every row
+	for(int j=0;j<n;j++)
+	{
+		int c = idx_set[j];
+		for(int k=outer[c];k<outer[c+1];k++)
+		{
+			int i = inv_set[inner[k]];
+			p_inner[pos[i]] = j;
+			p_values[pos[i]] = values[k];
+			pos[i]++;
+		}
+	}
+	s1 = p_rows;
+	return true;
 }
 
 void reorder_graphs(std::vector<graph_cluster*>& graphs, tree& bt)
@@ -280,81 +352,36 @@ void reorder_graphs(std::vector<graph_cluster*>& graphs, tree& bt)
 	// iterate over the original graphs to calculate reordered graphs
 	// FIVE properties to be updated: 1. Matrix(/graph); 2. Clusters; 3. n_clusters;
 
-	// reverse BFS: use queue and stack
-	queue <node*> bt_nodes;
-	bt_nodes.push(bt.get_root());
-	stack <node*> bt_nodes_reverse;
-
-	node* current_node = new node;
-	while(!bt_nodes.empty())
-	{
-		current_node = bt_nodes.front();
-		bt_nodes.pop();
-
-        //cout<<"DB1"<<endl;
-		if(current_node!=NULL)
-		{
-		    //cout<<"DB2"<<endl;
-			if(current_node->left==NULL && current_node->right==NULL)
-			{
-			    //cout<<"inside if statement"<<endl;
-			    break;
-			}
-            //cout<<"DB3"<<endl;
-			bt_nodes_reverse.push(current_node);
-			bt_nodes.push(current_node->left);
-			bt_nodes.push(current_node->right);
-		}
-	}
-	//cout<<"successful exit"<<endl;
-	// the nodes of cluster tree have been collected in reverse order (one level before leaves to root) in the stack
+	// the clusters of graph 'g' are the nodes on level graphs.size()-1-g of the tree: the children of a node (numbered by 'bt_idx'),
+	// or the indices of a leaf cluster; every level is a contiguous range of the node array of the tree
 	std::vector<std::vector<unsigned int> > dum_clusters;
 	int current_level = graphs.size()-1;
-	//cout<<"current_level: "<<current_level<<endl;
-	//cout<<bt_nodes_reverse.size()<<endl;
 	for(std::vector<graph_cluster*>::iterator itr= graphs.begin();itr!=std::prev(graphs.end());)
 	{
 		// collect clusters for this level
 		dum_clusters.clear();
-		current_node = bt_nodes_reverse.top();
-		bt_nodes_reverse.pop();
-		while(current_node->level == current_level)
+		for(unsigned int i=bt.level_begin(current_level);i<bt.level_end(current_level);i++)
 		{
-			//cout<<"current_level: "<<current_level<<endl;
+			node* current_node = bt.get_node(i);
 			std::vector<unsigned int> dum_v;
-			unsigned int dum_el =0;
-			if(current_node->left!=NULL)
-                dum_v.push_back(current_node->left->data.at(dum_el));
-			if(current_node->right!=NULL)
-				dum_v.push_back(current_node->right->data.at(dum_el));
+			for(unsigned int c=0;c<current_node->n_child;c++)
+				dum_v.push_back(bt.get_child(current_node,c)->bt_idx);
+			if(current_node->n_child==0)
+			{
+				// leaf cluster: its indices in the reordered matrix
+				for(unsigned int j=current_node->begin;j<current_node->end;j++)
+					dum_v.push_back(j);
+			}
 			dum_clusters.push_back(dum_v);
-			current_node = bt_nodes_reverse.top();
-			bt_nodes_reverse.pop();
 		}
-		bt_nodes_reverse.push(current_node);
-		std::reverse(dum_clusters.begin(),dum_clusters.end());
-		// cout<<"dum_clusters-size: "<<dum_clusters.size()<<endl;
-		// cout<<"//////"<<endl;
-		// for(std::vector<std::vector<int> >::iterator itr1=dum_clusters.begin();itr1!=dum_clusters.end();++itr1)
-		// {
-		// 	cout<<" <- ";
-		// 	for(std::vector<int>::iterator itr2=(*itr1).begin();itr2!=(*itr1).end();++itr2)
-		// 	{
-		// 		cout<<" "<<*itr2<<" ";
-		// 	}
-		// 	cout<<" -> ";
-		// }
-		// cout<<"///////"<<endl;
 
 		(*itr)->set_clusters(dum_clusters);
 		// coarsening of graph
 		SpMat* dum_mat = new SpMat(dum_clusters.size(),dum_clusters.size());
 		(*itr)->convert_to_coarser_graph(*dum_mat, dum_clusters);
-		//cout<<"error"<<endl;
 		std::advance(itr,1);
+		delete (*itr)->get_matrix(); // coarse graph matrix from 'generate_graphs', replaced by the reordered one
 		(*itr)->set_matrix(dum_mat);
 		current_level-=1;
 	}
-	current_node=NULL;
-	delete current_node;
 }
@@ -0,0 +1,455 @@
+/// \file matrix_io.cpp
+/// \brief Input of sparse matrices from files.
+
+#include "matrix_io.h"
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <stdint.h>
+#include <climits>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+mapped_file::mapped_file()
+{
+	data = NULL;
+	n_bytes = 0;
+}
+
+mapped_file::~mapped_file()
+{
+	close();
+}
+
+bool mapped_file::open(const std::string& filename)
+{
+	close();
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if(fd<0)
+	{
+		std::cout<<"Error: file open "<<filename<<std::endl;
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd,&st)!=0 || st.st_size==0)
+	{
+		std::cout<<"Error: file "<<filename<<" is empty or cannot be read"<<std::endl;
+		::close(fd);
+		return false;
+	}
+	void* ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); // the mapping stays valid without the descriptor
+	if(ptr==MAP_FAILED)
+	{
+		std::cout<<"Error: file "<<filename<<" cannot be mapped"<<std::endl;
+		return false;
+	}
+	madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+	data = static_cast<const char*>(ptr);
+	n_bytes = st.st_size;
+	return true;
+}
+
+void mapped_file::close(void)
+{
+	if(data!=NULL)
+		munmap(const_cast<char*>(data), n_bytes);
+	data = NULL;
+	n_bytes = 0;
+}
+
+void mapped_file::swap(mapped_file& other)
+{
+	std::swap(data, other.data);
+	std::swap(n_bytes, other.n_bytes);
+}
+
+// header of the binary CSC format
+struct binary_matrix_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t index_bytes;
+	uint32_t value_bytes;
+	uint32_t reserved;
+	int64_t rows;
+	int64_t cols;
+	int64_t nnz;
+};
+
+static const char binary_matrix_magic[8] = "HMATCSC";
+static const uint32_t binary_matrix_version = 1;
+
+// arrays of the binary formats start at multiples of 8 bytes
+static std::size_t align8(std::size_t offset)
+{
+	return (offset+7)/8*8;
+}
+
+binary_matrix::binary_matrix()
+{
+	n_rows = 0;
+	n_cols = 0;
+	nnz = 0;
+	col_ptr = NULL;
+	row_idx = NULL;
+	values = NULL;
+}
+
+bool binary_matrix::open(const std::string& filename)
+{
+	close();
+	if(!file.open(filename))
+		return false;
+	binary_matrix_header h;
+	if(file.size()<sizeof(h))
+	{
+		std::cout<<"Error in binary_matrix: "<<filename<<" is too short"<<std::endl;
+		close();
+		return false;
+	}
+	std::memcpy(&h, file.begin(), sizeof(h));
+	if(std::memcmp(h.magic, binary_matrix_magic, 8)!=0 || h.version!=binary_matrix_version
+		|| h.index_bytes!=sizeof(int) || h.value_bytes!=sizeof(double))
+	{
+		std::cout<<"Error in binary_matrix: "<<filename<<" is not a binary matrix of version "<<binary_matrix_version<<std::endl;
+		close();
+		return false;
+	}
+	std::size_t row_offset = align8(sizeof(h) + (h.cols+1)*sizeof(int));
+	std::size_t value_offset = align8(row_offset + h.nnz*sizeof(int));
+	if(h.rows<0 || h.cols<0 || h.nnz<0 || h.rows>INT32_MAX || h.cols>=INT32_MAX || h.nnz>INT32_MAX
+		|| file.size()<value_offset + h.nnz*sizeof(double))
+	{
+		std::cout<<"Error in binary_matrix: sizes in the header of "<<filename<<" do not match the file"<<std::endl;
+		close();
+		return false;
+	}
+	n_rows = h.rows;
+	n_cols = h.cols;
+	nnz = h.nnz;
+	col_ptr = reinterpret_cast<const int*>(file.begin() + sizeof(h));
+	row_idx = reinterpret_cast<const int*>(file.begin() + row_offset);
+	values = reinterpret_cast<const double*>(file.begin() + value_offset);
+	bool valid = (col_ptr[0]==0 && col_ptr[n_cols]==nnz);
+	for(int j=0;j<n_cols && valid;j++)
+		valid = (col_ptr[j]<=col_ptr[j+1]);
+	if(!valid)
+	{
+		std::cout<<"Error in binary_matrix: invalid column pointers in "<<filename<<std::endl;
+		close();
+		return false;
+	}
+	// one pass over the row indices: every index lies in the matrix and they are strictly increasing within a column, as Eigen expects
+	for(int j=0;j<n_cols && valid;j++)
+	{
+		for(int k=col_ptr[j];k<col_ptr[j+1] && valid;k++)
+			valid = (row_idx[k]>=0 && row_idx[k]<n_rows && (k==col_ptr[j] || row_idx[k-1]<row_idx[k]));
+	}
+	if(!valid)
+	{
+		std::cout<<"Error in binary_matrix: invalid row indices in "<<filename<<std::endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+void binary_matrix::close(void)
+{
+	file.close();
+	n_rows = 0;
+	n_cols = 0;
+	nnz = 0;
+	col_ptr = NULL;
+	row_idx = NULL;
+	values = NULL;
+}
+
+Eigen::Map<const Eigen::SparseMatrix<double> > binary_matrix::matrix(void) const
+{
+	return Eigen::Map<const Eigen::SparseMatrix<double> >(n_rows, n_cols, nnz, col_ptr, row_idx, values);
+}
+
+Eigen::Map<const Eigen::SparseMatrix<double> > sparse_map(const Eigen::SparseMatrix<double>& sm)
+{
+	return Eigen::Map<const Eigen::SparseMatrix<double> >(sm.rows(), sm.cols(), sm.nonZeros(), sm.outerIndexPtr(), sm.innerIndexPtr(), sm.valuePtr());
+}
+
+bool write_binary_matrix(const std::string& filename, const Eigen::SparseMatrix<double>& sm)
+{
+	if(sm.isCompressed())
+		return write_binary_matrix(filename, sparse_map(sm));
+	Eigen::SparseMatrix<double> compressed = sm;
+	compressed.makeCompressed();
+	return write_binary_matrix(filename, sparse_map(compressed));
+}
+
+bool write_binary_matrix(const std::string& filename, const Eigen::Map<const Eigen::SparseMatrix<double> >& sm)
+{
+	binary_matrix_header h;
+	std::memcpy(h.magic, binary_matrix_magic, 8);
+	h.version = binary_matrix_version;
+	h.index_bytes = sizeof(int);
+	h.value_bytes = sizeof(double);
+	h.reserved = 0;
+	h.rows = sm.rows();
+	h.cols = sm.cols();
+	h.nnz = sm.nonZeros();
+
+	std::ofstream op(filename.c_str(), std::ios::binary);
+	if(!op.is_open())
+	{
+		std::cout<<"Error: file open "<<filename<<std::endl;
+		return false;
+	}
+	const char zeros[8] = {0,0,0,0,0,0,0,0};
+	std::size_t offset = sizeof(h);
+	op.write(reinterpret_cast<const char*>(&h), sizeof(h));
+	op.write(reinterpret_cast<const char*>(sm.outerIndexPtr()), (h.cols+1)*sizeof(int));
+	offset += (h.cols+1)*sizeof(int);
+	op.write(zeros, align8(offset)-offset);
+	offset = align8(offset);
+	op.write(reinterpret_cast<const char*>(sm.innerIndexPtr()), h.nnz*sizeof(int));
+	offset += h.nnz*sizeof(int);
+	op.write(zeros, align8(offset)-offset);
+	op.write(reinterpret_cast<const char*>(sm.valuePtr()), h.nnz*sizeof(double));
+	if(!op.good())
+	{
+		std::cout<<"Error: writing "<<filename<<" failed"<<std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool is_binary_matrix(const std::string& filename)
+{
+	std::ifstream ip(filename.c_str(), std::ios::binary);
+	char magic[8];
+	return ip.read(magic, 8) && std::memcmp(magic, binary_matrix_magic, 8)==0;
+}
+
+bool read_matrix(const std::string& filename, Eigen::SparseMatrix<double>& sm)
+{
+	if(!is_binary_matrix(filename))
+		return read_matrix_market(filename, sm);
+	binary_matrix bm;
+	if(!bm.open(filename))
+		return false;
+	sm = bm.matrix();
+	std::cout<<"Input success: Matrix dimensions "<<sm.rows()<<","<<sm.cols()<<", entries "<<sm.nonZeros()<<std::endl;
+	return true;
+}
+
+// the parsers below work on [p,end) of the mapped file, which is not null-terminated; they never allocate
+
+static void skip_blanks(const char*& p, const char* end)
+{
+	while(p!=end && (*p==' ' || *p=='\t' || *p=='\r'))
+		++p;
+}
+
+static void skip_line(const char*& p, const char* end)
+{
+	while(p!=end && *p!='\n')
+		++p;
+	if(p!=end)
+		++p;
+}
+
+// values above INT_MAX in magnitude are rejected: they are no valid sizes or indices of an Eigen matrix, and the digits are not accumulated any further
+static bool parse_int(const char*& p, const char* end, long& v)
+{
+	skip_blanks(p,end);
+	bool negative = false;
+	if(p!=end && (*p=='-' || *p=='+'))
+	{
+		negative = (*p=='-');
+		++p;
+	}
+	if(p==end || *p<'0' || *p>'9')
+		return false;
+	v = 0;
+	while(p!=end && *p>='0' && *p<='9')
+	{
+		v = 10*v + (*p-'0');
+		if(v>INT_MAX)
+			return false;
+		++p;
+	}
+	if(negative)
+		v = -v;
+	return true;
+}
+
+static bool parse_double(const char*& p, const char* end, double& v)
+{
+	// the token is copied to a null-terminated buffer on the stack for 'strtod', which gives correctly rounded values
+	skip_blanks(p,end);
+	char buf[64];
+	int n = 0;
+	while(p!=end && *p!=' ' && *p!='\t' && *p!='\r' && *p!='\n')
+	{
+		if(n==63)
+			return false;
+		buf[n++] = *p++;
+	}
+	if(n==0)
+		return false;
+	buf[n] = '\0';
+	char* last;
+	v = std::strtod(buf,&last);
+	return last==buf+n;
+}
+
+// next whitespace separated word of the current line, in lower case
+static std::string next_word(const char*& p, const char* end)
+{
+	skip_blanks(p,end);
+	std::string word;
+	while(p!=end && *p!=' ' && *p!='\t' && *p!='\r' && *p!='\n')
+	{
+		char c = *p++;
+		word.push_back((c>='A' && c<='Z') ? c-'A'+'a' : c);
+	}
+	return word;
+}
+
+bool read_matrix_market(const std::string& filename, Eigen::SparseMatrix<double>& sm)
+{
+	mapped_file file;
+	if(!file.open(filename))
+		return false;
+	const char* p = file.begin();
+	const char* end = file.end();
+
+	// banner: %%MatrixMarket matrix coordinate <field> <symmetry>
+	if(next_word(p,end)!="%%matrixmarket" || next_word(p,end)!="matrix" || next_word(p,end)!="coordinate")
+	{
+		std::cout<<"Error in read_matrix_market: "<<filename<<" is not a Matrix Market coordinate file"<<std::endl;
+		return false;
+	}
+	std::string field = next_word(p,end);
+	std::string symmetry = next_word(p,end);
+	bool pattern = (field=="pattern");
+	if(field!="real" && field!="integer" && !pattern)
+	{
+		std::cout<<"Error in read_matrix_market: field '"<<field<<"' is not supported"<<std::endl;
+		return false;
+	}
+	int mirror = 0; // 1: symmetric, -1: skew-symmetric; the entries above the diagonal are not stored in the file
+	if(symmetry=="symmetric")
+		mirror = 1;
+	else if(symmetry=="skew-symmetric")
+		mirror = -1;
+	else if(symmetry!="general")
+	{
+		std::cout<<"Error in read_matrix_market: symmetry '"<<symmetry<<"' is not supported"<<std::endl;
+		return false;
+	}
+	skip_line(p,end);
+
+	// comments, then the size line: rows cols entries
+	while(p!=end && (*p=='%' || *p=='\n' || *p=='\r'))
+		skip_line(p,end);
+	long n_rows, n_cols, n_entries;
+	if(!parse_int(p,end,n_rows) || !parse_int(p,end,n_cols) || !parse_int(p,end,n_entries) || n_rows<0 || n_cols<0 || n_entries<0)
+	{
+		std::cout<<"Error in read_matrix_market: invalid size line in "<<filename<<std::endl;
+		return false;
+	}
+	skip_line(p,end);
+
+	// the entries are split into chunks at line breaks; every chunk is parsed into its own list of triplets
+	typedef Eigen::Triplet<double> T;
+	int n_chunks = 1;
+#ifdef _OPENMP
+	n_chunks = 4*omp_get_max_threads();
+#endif
+	std::vector<const char*> chunk_begin(n_chunks+1);
+	for(int c=0;c<n_chunks;c++)
+	{
+		const char* q = p + (end-p)*c/n_chunks;
+		if(c>0 && q!=p && *(q-1)!='\n')
+			skip_line(q,end);
+		chunk_begin[c] = q;
+	}
+	chunk_begin[n_chunks] = end;
+	std::vector<std::vector<T> > chunk_entries(n_chunks);
+	std::vector<long> chunk_lines(n_chunks,0);
+	std::vector<long> bad_offset(n_chunks,-1); // byte offset of the first invalid line of the chunk
+
+	#pragma omp parallel for schedule(dynamic,1)
+	for(int c=0;c<n_chunks;c++)
+	{
+		const char* q = chunk_begin[c];
+		const char* q_end = chunk_begin[c+1];
+		std::vector<T>& entries = chunk_entries[c];
+		entries.reserve((mirror ? 2 : 1)*(n_entries/n_chunks + 1));
+		while(q<q_end)
+		{
+			skip_blanks(q,q_end);
+			if(q==q_end)
+				break;
+			if(*q=='\n' || *q=='%')
+			{
+				skip_line(q,q_end);
+				continue;
+			}
+			const char* line = q;
+			long i, j;
+			double v = 1.0;
+			if(!parse_int(q,q_end,i) || !parse_int(q,q_end,j) || (!pattern && !parse_double(q,q_end,v))
+				|| i<1 || i>n_rows || j<1 || j>n_cols)
+			{
+				bad_offset[c] = line - file.begin();
+				break;
+			}
+			entries.push_back(T(i-1,j-1,v));
+			if(mirror && i!=j)
+				entries.push_back(T(j-1,i-1,mirror*v));
+			chunk_lines[c]++;
+			skip_line(q,q_end);
+		}
+	}
+
+	long n_read = 0;
+	std::vector<std::size_t> offset(n_chunks+1,0);
+	for(int c=0;c<n_chunks;c++)
+	{
+		if(bad_offset[c]>=0)
+		{
+			std::cout<<"Error in read_matrix_market: invalid entry at byte "<<bad_offset[c]<<" of "<<filename<<std::endl;
+			return false;
+		}
+		n_read += chunk_lines[c];
+		offset[c+1] = offset[c] + chunk_entries[c].size();
+	}
+	if(n_read!=n_entries)
+	{
+		std::cout<<"Error in read_matrix_market: "<<filename<<" has "<<n_read<<" entries, the header gives "<<n_entries<<std::endl;
+		return false;
+	}
+
+	// assembly of the compressed column storage
+	std::vector<T> triplets(offset[n_chunks]);
+	#pragma omp parallel for schedule(dynamic,1)
+	for(int c=0;c<n_chunks;c++)
+	{
+		std::copy(chunk_entries[c].begin(),chunk_entries[c].end(),triplets.begin()+offset[c]);
+		std::vector<T>().swap(chunk_entries[c]);
+	}
+	sm.resize(n_rows,n_cols);
+	sm.setFromTriplets(triplets.begin(),triplets.end());
+
+	std::cout<<"Input success: Matrix dimensions "<<sm.rows()<<","<<sm.cols()<<", entries "<<sm.nonZeros()<<std::endl;
+	return true;
+}
@@ -0,0 +1,70 @@
+/// \file matrix_io.h
+/// \brief Input of sparse matrices from files.
+
+#ifndef MATRIX_IO_H
+#define MATRIX_IO_H
+
+#include <Eigen/SparseCore>
+#include <string>
+#include <cstddef>
+
+/// Read-only memory map of a whole file. The mapping is released by 'close' or by the destructor.
+class mapped_file
+{
+private:
+	const char* data;
+	std::size_t n_bytes;
+	// the mapping is owned by the object: no copies
+	mapped_file(const mapped_file&);
+	mapped_file& operator=(const mapped_file&);
+public:
+	mapped_file();
+	~mapped_file();
+	/// Maps the file; returns false (with a message on the console) if it cannot be opened or is empty.
+	bool open(const std::string& filename);
+	void close(void);
+	/// Exchanges the mappings of the two objects.
+	void swap(mapped_file&);
+	const char* begin(void) const { return data; }
+	const char* end(void) const { return data + n_bytes; }
+	std::size_t size(void) const { return n_bytes; }
+};
+
+/// Sparse matrix in the binary CSC format, memory mapped and used in place without parsing.
+/// The format (version 1, native byte order) is a 48 byte header followed by three arrays, each starting at a multiple of 8 bytes:
+/// header: magic "HMATCSC" (8 bytes with the terminating zero); version, bytes per index (4), bytes per value (8) and a reserved field as uint32; rows, cols, nnz as int64;
+/// col_ptr: cols+1 int32; row_idx: nnz int32, strictly increasing within every column; values: nnz double.
+class binary_matrix
+{
+private:
+	mapped_file file;
+	int n_rows, n_cols, nnz;
+	const int* col_ptr;
+	const int* row_idx;
+	const double* values;
+public:
+	binary_matrix();
+	/// Maps the file and checks the header, the column pointers and the row indices (in one pass over the entries); returns false (with a message on the console) if the file is not a valid binary matrix.
+	bool open(const std::string& filename);
+	void close(void);
+	/// The mapped matrix; valid while the file stays open.
+	Eigen::Map<const Eigen::SparseMatrix<double> > matrix(void) const;
+};
+
+/// Map of the arrays of 'sm', which must be compressed; valid while 'sm' is neither changed nor destroyed.
+Eigen::Map<const Eigen::SparseMatrix<double> > sparse_map(const Eigen::SparseMatrix<double>& sm);
+/// Writes 'sm' in the binary CSC format described at 'binary_matrix'.
+bool write_binary_matrix(const std::string& filename, const Eigen::SparseMatrix<double>& sm);
+bool write_binary_matrix(const std::string& filename, const Eigen::Map<const Eigen::SparseMatrix<double> >& sm);
+/// True if the file starts with the magic of the binary CSC format.
+bool is_binary_matrix(const std::string& filename);
+/// Reads a sparse matrix from a binary CSC file or, otherwise, from a Matrix Market file. A binary matrix is copied into 'sm';
+/// to use it in place, open it as 'binary_matrix' instead (as 'main' does).
+bool read_matrix(const std::string& filename, Eigen::SparseMatrix<double>& sm);
+
+/// Reads a sparse matrix from a Matrix Market coordinate file ('real', 'integer' or 'pattern'; 'general', 'symmetric' or 'skew-symmetric').
+/// The dimensions are taken from the header. The file is memory mapped and split into chunks of lines which are parsed in parallel;
+/// the entries are then assembled into 'sm' from triplets. Returns false (with a message on the console) if the file cannot be read.
+bool read_matrix_market(const std::string& filename, Eigen::SparseMatrix<double>& sm);
+
+#endif
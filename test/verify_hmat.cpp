@@ -0,0 +1,849 @@
+/// \file verify_hmat.cpp
+/// \brief Checks of the matrix readers and of the H-Matrix products against the products of the sparse matrix it is built from; not part of the library.
+///
+/// The H-Matrix is built by the same steps as in 'main' (main.cpp is included with its 'main' renamed) from a 2D Laplacian with weak couplings between
+/// random pairs of vertices, so that admissible blocks hold entries; the rk blocks are built with a tight accuracy, so the products must agree closely. Build from the root of the repository, e.g.
+///   g++ -std=c++11 -O2 -fopenmp -I/usr/include/eigen3 -I. test/verify_hmat.cpp h_mat.cpp matrix_io.cpp tree.cpp graph_cluster.cpp block_cluster.cpp -o verify_hmat
+/// Add -DHMAT_USE_RSVD to check the H-Matrix built by the randomized SVD instead of ACA+. Prints one line per check; returns 1 if any check fails.
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#define main hm_main
+#include "../main.cpp"
+#undef main
+#include "../hmat_file.h"
+
+static int n_failed = 0;
+
+// prints the result of one check
+static void check(const std::string& name, double err, double tol)
+{
+	bool ok = (err<=tol);
+	std::cout<<(ok ? "ok     " : "FAILED ")<<name<<": error "<<err<<" (tolerance "<<tol<<")"<<std::endl;
+	if(!ok)
+		n_failed++;
+}
+
+static double rel_err(const Eigen::MatrixXd& x, const Eigen::MatrixXd& ref)
+{
+	double n = ref.norm();
+	return (n>0.0) ? (x-ref).norm()/n : (x-ref).norm();
+}
+
+// 5-point Laplacian on a g x g grid, plus 'n_far' weak symmetric couplings between pseudo-random pairs of vertices
+static SpMat test_matrix(int g, int n_far)
+{
+	int n = g*g;
+	std::vector<Eigen::Triplet<double> > entries;
+	for(int i=0;i<g;i++)
+	{
+		for(int j=0;j<g;j++)
+		{
+			int k = i*g + j;
+			entries.push_back(Eigen::Triplet<double>(k, k, 4.0));
+			if(i>0)
+				entries.push_back(Eigen::Triplet<double>(k, k-g, -1.0));
+			if(i<g-1)
+				entries.push_back(Eigen::Triplet<double>(k, k+g, -1.0));
+			if(j>0)
+				entries.push_back(Eigen::Triplet<double>(k, k-1, -1.0));
+			if(j<g-1)
+				entries.push_back(Eigen::Triplet<double>(k, k+1, -1.0));
+		}
+	}
+	// the weights are far below 1, so the clusters they couple stay admissible
+	unsigned int seed = 12345;
+	for(int f=0;f<n_far;f++)
+	{
+		seed = seed*1103515245u + 12345u;
+		int r = (seed>>8)%n;
+		seed = seed*1103515245u + 12345u;
+		int c = (seed>>8)%n;
+		double v = 0.01*(1 + f%7);
+		entries.push_back(Eigen::Triplet<double>(r, c, v));
+		entries.push_back(Eigen::Triplet<double>(c, r, v));
+	}
+	SpMat a(n,n);
+	a.setFromTriplets(entries.begin(), entries.end());
+	return a;
+}
+
+// writes 'text' to a file and reads it back with 'read_matrix_market'; returns false if the file is rejected
+static bool read_text(const std::string& name, const std::string& text, SpMat& sm)
+{
+	std::string filename = "verify_hmat_" + name + ".mtx";
+	std::ofstream op(filename.c_str(), std::ios::binary);
+	op<<text;
+	op.close();
+	bool ok = read_matrix_market(filename, sm);
+	std::remove(filename.c_str());
+	return ok;
+}
+
+// reads 'text' and compares the matrix with 'ref'
+static void check_matrix_market(const std::string& name, const std::string& text, const Eigen::MatrixXd& ref)
+{
+	SpMat sm;
+	if(!read_text(name, text, sm) || sm.rows()!=ref.rows() || sm.cols()!=ref.cols())
+	{
+		std::cout<<"FAILED matrix market "<<name<<": not read"<<std::endl;
+		n_failed++;
+		return;
+	}
+	check("matrix market " + name, (Eigen::MatrixXd(sm)-ref).norm(), 0.0);
+}
+
+static void verify_matrix_market(void)
+{
+	// only the lower triangle is stored; the upper one is mirrored
+	Eigen::MatrixXd sym(3,3);
+	sym<<4,-1,0,
+		-1,4,2.5,
+		0,2.5,4;
+	check_matrix_market("symmetric", "%%MatrixMarket matrix coordinate real symmetric\n% comment\n3 3 5\n1 1 4\n2 1 -1\n2 2 4\n3 2 2.5\n3 3 4\n", sym);
+	Eigen::MatrixXd skew(3,3);
+	skew<<0,-2,0,
+		2,0,-1,
+		0,1,0;
+	check_matrix_market("skew-symmetric", "%%MatrixMarket matrix coordinate real skew-symmetric\n3 3 2\n2 1 2\n3 2 1\n", skew);
+	// every stored entry is 1; CRLF line ends and no newline after the last line
+	Eigen::MatrixXd pat = Eigen::MatrixXd::Zero(3,4);
+	pat(0,0) = 1;
+	pat(2,1) = 1;
+	pat(1,3) = 1;
+	check_matrix_market("pattern", "%%MatrixMarket matrix coordinate pattern general\r\n3 4 3\r\n1 1\r\n3 2\r\n2 4", pat);
+	Eigen::MatrixXd sym_pat(3,3);
+	sym_pat<<0,1,0,
+		1,1,1,
+		0,1,0;
+	check_matrix_market("symmetric pattern", "%%MatrixMarket matrix coordinate pattern symmetric\n3 3 3\n2 1\n2 2\n3 2\n", sym_pat);
+
+	// an index outside the matrix and a missing entry must be rejected
+	SpMat sm;
+	check("matrix market index out of range rejected", read_text("range", "%%MatrixMarket matrix coordinate real general\n2 2 1\n3 1 1.0\n", sm) ? 1.0 : 0.0, 0.0);
+	check("matrix market missing entry rejected", read_text("short", "%%MatrixMarket matrix coordinate real general\n2 2 2\n1 1 1.0\n", sm) ? 1.0 : 0.0, 0.0);
+	// sizes above INT_MAX, also ones which overflow a long, must be rejected
+	check("matrix market size above INT_MAX rejected", read_text("int_max", "%%MatrixMarket matrix coordinate real general\n2147483648 2 1\n1 1 1.0\n", sm) ? 1.0 : 0.0, 0.0);
+	check("matrix market over-long size line rejected", read_text("long", "%%MatrixMarket matrix coordinate real general\n2 99999999999999999999999999 1\n1 1 1.0\n", sm) ? 1.0 : 0.0, 0.0);
+}
+
+// writes 'a' in the binary CSC format and reads it back, through 'read_matrix' and through the mapping itself, which is also reordered; corrupted files must be rejected
+static void verify_binary_matrix(const SpMat& a)
+{
+	std::string filename = "verify_hmat_matrix.csc";
+	SpMat b;
+	binary_matrix bm;
+	if(!write_binary_matrix(filename, a) || !read_matrix(filename, b) || !bm.open(filename))
+	{
+		std::cout<<"FAILED binary matrix roundtrip: file not written or not read"<<std::endl;
+		n_failed++;
+		std::remove(filename.c_str());
+		return;
+	}
+	check("binary matrix roundtrip", (b.rows()==a.rows() && b.cols()==a.cols()) ? (b-a).norm() : 1.0, 0.0);
+	SpMat c = bm.matrix();
+	check("binary matrix mapped in place", (c.rows()==a.rows() && c.cols()==a.cols()) ? (c-a).norm() : 1.0, 0.0);
+	// reordering straight from the mapping, as 'main' does, against the reordering of the copy; the index set reverses the indices
+	std::vector<unsigned int> idx_set(a.cols());
+	for(int i=0;i<a.cols();i++)
+		idx_set[i] = a.cols()-1-i;
+	SpMat p_mapped;
+	bool reordered = reorder_matrix(bm.matrix(), idx_set, p_mapped) && reorder_matrix(b, idx_set);
+	check("binary matrix reordered from the mapping", (reordered && p_mapped.rows()==b.rows()) ? (p_mapped-b).norm() : 1.0, 0.0);
+	bm.close();
+
+	// corrupted row indices must be rejected; they follow the 48 byte header and the column pointers, starting at a multiple of 8 bytes
+	std::ifstream ip(filename.c_str(), std::ios::binary);
+	std::string bytes((std::istreambuf_iterator<char>(ip)), std::istreambuf_iterator<char>());
+	ip.close();
+	std::size_t row_offset = (48 + (a.cols()+1)*sizeof(int) + 7)/8*8;
+	int bad_rows[3] = {2000000000, -1, 0}; // 0 repeats the first row of the first column
+	const char* names[3] = {"row index out of range", "negative row index", "repeated row index"};
+	for(int t=0;t<3;t++)
+	{
+		std::string corrupt = bytes;
+		std::memcpy(&corrupt[row_offset + (t==2 ? sizeof(int) : 0)], &bad_rows[t], sizeof(int));
+		std::ofstream op(filename.c_str(), std::ios::binary);
+		op.write(corrupt.data(), corrupt.size());
+		op.close();
+		check(std::string("binary matrix with ") + names[t] + " rejected", read_matrix(filename, b) ? 1.0 : 0.0, 0.0);
+	}
+	std::remove(filename.c_str());
+}
+
+// the steps of 'main': coarsening with the given matching, cluster tree, reordering, block cluster tree with leaf size 'block_leaf_size' and H-Matrix;
+// 'idx_set' gets the index set of the cluster tree. Returns NULL (with a message) if the index set is rejected; the caller deletes the H-Matrix.
+static hmat* build_hmat(const SpMat& a, bool parallel_match, int agg_size, int leaf_size, int block_leaf_size, int max_rank, double eps, std::vector<unsigned int>& idx_set)
+{
+	// as in 'main', the input is only read through a map until it is reordered into 's1'
+	graph_cluster g1(sparse_map(a));
+	std::vector<graph_cluster*> graphs;
+	graphs.push_back(&g1);
+	generate_graphs(graphs,a.cols(),parallel_match,agg_size,leaf_size);
+	std::vector<unsigned int> dum_v;
+	dum_v.push_back(0);
+	tree bt(dum_v);
+	bt.graphs_to_tree(graphs);
+	idx_set.clear();
+	bt.map_index(graphs, idx_set);
+	hmat* h = NULL;
+	SpMat s1;
+	if(reorder_matrix(sparse_map(a),idx_set,s1))
+	{
+		g1.set_matrix(&s1);
+		bt.update_bt_idx();
+		reorder_graphs(graphs, bt);
+		bt.cluster_tree();
+		bctree bct;
+		bct.block_cluster(bt, graphs, block_leaf_size);
+		h = new hmat(bct, &s1, max_rank, idx_set, eps);
+	}
+	else
+		std::cout<<"FAILED reorder_matrix: index set of the cluster tree rejected"<<std::endl;
+
+	// the coarse graphs and their matrices were allocated by 'generate_graphs'; graphs[0] is the input graph
+	for(unsigned int i=1;i<graphs.size();i++)
+	{
+		delete graphs[i]->get_matrix();
+		delete graphs[i];
+	}
+	return h;
+}
+
+// coarsening with the parallel handshake matching and aggregation: pairwise down to single indices, k-way, and k-way after leaf aggregation as in 'main'.
+// The index set and the H-Matrix must not depend on the number of threads, and the H-Matrix must be as accurate as with the serial coarsening.
+static void verify_parallel_matching(const SpMat& a)
+{
+#ifdef _OPENMP
+	int max_threads = omp_get_max_threads();
+#endif
+	Eigen::VectorXd x = Eigen::VectorXd::Random(a.cols());
+	Eigen::VectorXd ax = a*x;
+	int agg_sizes[4] = {0, 2, 4, 4}; // 0 and 2 both match pairs
+	int leaf_sizes[4] = {0, 0, 0, 16};
+	for(int g=0;g<4;g++)
+	{
+		std::string agg = "agg_size " + std::to_string(agg_sizes[g]) + ", leaf_size " + std::to_string(leaf_sizes[g]);
+		std::vector<unsigned int> idx_serial;
+		hmat* h_serial = build_hmat(a, false, agg_sizes[g], leaf_sizes[g], 16, 50, 1e-10, idx_serial);
+		if(h_serial==NULL)
+		{
+			n_failed++;
+			continue;
+		}
+		Eigen::VectorXd y_serial;
+		h_serial->apply(x, y_serial);
+		delete h_serial;
+		check("serial coarsening, " + agg + ", H*x against A*x", rel_err(y_serial, ax), 1e-8);
+
+		std::vector<unsigned int> idx_ref;
+		Eigen::VectorXd y_ref;
+		int threads[3] = {1, 2, 4};
+		for(int t=0;t<3;t++)
+		{
+#ifdef _OPENMP
+			omp_set_num_threads(threads[t]);
+#endif
+			std::vector<unsigned int> idx_set;
+			hmat* h = build_hmat(a, true, agg_sizes[g], leaf_sizes[g], 16, 50, 1e-10, idx_set);
+			if(h==NULL)
+			{
+				n_failed++;
+				continue;
+			}
+			Eigen::VectorXd y;
+			h->apply(x, y);
+			delete h;
+			std::string name = "parallel coarsening, " + agg + ", " + std::to_string(threads[t]) + " threads";
+			if(t==0)
+			{
+				idx_ref = idx_set;
+				y_ref = y;
+				check(name + ", H*x against A*x", rel_err(y, ax), 1e-8);
+				check(name + ", H*x against serial coarsening", rel_err(y, y_serial), 1e-8);
+			}
+			else
+			{
+				check(name + ", index set as with 1 thread", (idx_set==idx_ref) ? 0.0 : 1.0, 0.0);
+				check(name + ", H*x as with 1 thread", (y-y_ref).norm(), 0.0);
+			}
+		}
+	}
+#ifdef _OPENMP
+	omp_set_num_threads(max_threads);
+#endif
+}
+
+// ACA+ on a block with a dense rank 1 part and a few isolated entries, whose rows and columns are not coupled to anything else:
+// the references show a zero residual long before all entries are seen, so the approximation must not stop there
+static void verify_aca_isolated_entries(void)
+{
+	int n = 55;
+	std::vector<Eigen::Triplet<double> > entries;
+	for(int j=0;j<50;j++)
+		for(int i=0;i<50;i++)
+			entries.push_back(Eigen::Triplet<double>(i,j,(1.0+0.1*i)*(1.0-0.01*j)));
+	for(int t=0;t<5;t++)
+		entries.push_back(Eigen::Triplet<double>(50+t,54-t,0.5));
+	SpMat csc(n,n);
+	csc.setFromTriplets(entries.begin(),entries.end());
+	Eigen::SparseMatrix<double,Eigen::RowMajor> csr = csc;
+	Eigen::MatrixXd dense = Eigen::MatrixXd(csc);
+	sparse_block blk;
+	blk.csc = &csc;
+	blk.csr = &csr;
+	blk.start_row = 0;
+	blk.start_col = 0;
+	blk.n_rows = n;
+	blk.n_cols = n;
+
+	hmat h;
+	double eps[2] = {1e-6, 0.0};
+	for(int t=0;t<2;t++)
+	{
+		rkmat rk_sparse, rk_dense;
+		h.CA_partial_pivot(blk, &rk_sparse, 50, eps[t]);
+		h.CA_partial_pivot(dense, &rk_dense, 50, eps[t]);
+		std::string e = (t==0) ? "1e-6" : "0";
+		check("ACA+ with isolated entries, sparse block, eps " + e, rel_err(rk_sparse.a*rk_sparse.b.transpose(), dense), std::max(eps[t],1e-12));
+		check("ACA+ with isolated entries, dense block, eps " + e, rel_err(rk_dense.a*rk_dense.b.transpose(), dense), std::max(eps[t],1e-12));
+		// the block has rank 6
+		check("ACA+ with isolated entries, rank of the sparse block, eps " + e, std::max(rk_sparse.kt-6,0), 0.0);
+	}
+}
+
+// ACA+ on a block of ones with one entry not stored: after the first pivot the residual lies only on that entry, and the fresh references
+// and all stored entries show a zero residual, so the next pivot has to be found among the entries which are not stored
+static void verify_aca_residual_off_entries(void)
+{
+	int n = 6; // the block is the 4 x 4 block at offset (1,2)
+	std::vector<Eigen::Triplet<double> > entries;
+	for(int j=0;j<4;j++)
+		for(int i=0;i<4;i++)
+			if(i!=2 || j!=2)
+				entries.push_back(Eigen::Triplet<double>(1+i,2+j,1.0));
+	entries.push_back(Eigen::Triplet<double>(0,0,3.0)); // outside the block
+	SpMat csc(n,n);
+	csc.setFromTriplets(entries.begin(),entries.end());
+	Eigen::SparseMatrix<double,Eigen::RowMajor> csr = csc;
+	Eigen::MatrixXd dense = Eigen::MatrixXd(csc).block(1,2,4,4);
+	sparse_block blk;
+	blk.csc = &csc;
+	blk.csr = &csr;
+	blk.start_row = 1;
+	blk.start_col = 2;
+	blk.n_rows = 4;
+	blk.n_cols = 4;
+
+	hmat h;
+	double eps[2] = {1e-8, 0.0};
+	for(int t=0;t<2;t++)
+	{
+		rkmat rk;
+		h.CA_partial_pivot(blk, &rk, 4, eps[t]);
+		std::string e = (t==0) ? "1e-8" : "0";
+		check("ACA+ with the residual off the stored entries, eps " + e, rel_err(rk.a*rk.b.transpose(), dense), std::max(eps[t],1e-12));
+		// the block has rank 2
+		check("ACA+ with the residual off the stored entries, rank, eps " + e, std::abs(rk.kt-2), 0.0);
+	}
+}
+
+// randomized SVD on three blocks of one matrix: a dense block of rank 3 (rows 0-39, cols 0-29) and two sparse blocks of full rank,
+// the second one too large for the first sample without a rank bound (rows 40-69, cols 30-54 and rows 70-119, cols 60-119)
+static void verify_rsvd(void)
+{
+	int n = 120;
+	std::vector<Eigen::Triplet<double> > entries;
+	for(int j=0;j<30;j++)
+		for(int i=0;i<40;i++)
+			entries.push_back(Eigen::Triplet<double>(i,j,std::cos(0.3*i)*std::sin(0.2*j+1.0) + 0.5*std::cos(0.7*i)*(1.0+0.1*j) + 0.1*std::cos(1.3*i+0.2)*std::cos(0.9*j)));
+	unsigned int seed = 2024;
+	for(int j=30;j<120;j++)
+	{
+		for(int i=40;i<n;i++)
+		{
+			if((i<70) != (j<55))
+				continue;
+			seed = seed*1103515245u + 12345u;
+			if((seed>>8)%10<3)
+				entries.push_back(Eigen::Triplet<double>(i,j,((seed>>4)%1000)/500.0-1.0));
+		}
+	}
+	SpMat csc(n,n);
+	csc.setFromTriplets(entries.begin(),entries.end());
+	Eigen::SparseMatrix<double,Eigen::RowMajor> csr = csc;
+	int start_row[3] = {0, 40, 70}, start_col[3] = {0, 30, 60}, rows[3] = {40, 30, 50}, cols[3] = {30, 25, 60};
+	std::vector<sparse_block> blks(3);
+	for(int b=0;b<3;b++)
+	{
+		blks[b].csc = &csc;
+		blks[b].csr = &csr;
+		blks[b].start_row = start_row[b];
+		blks[b].start_col = start_col[b];
+		blks[b].n_rows = rows[b];
+		blks[b].n_cols = cols[b];
+	}
+
+	hmat h;
+	Eigen::MatrixXd low_rank = Eigen::MatrixXd(csc).block(0,0,40,30);
+	double eps = 1e-8;
+	int r[3] = {0, 10, 2}; // no rank bound, a bound above the rank and one below it
+	for(int t=0;t<3;t++)
+	{
+		rkmat rk;
+		h.RSVD(blks[0], &rk, r[t], (t<2) ? eps : 0.0);
+		std::string name = "RSVD of a block of rank 3, rank bound " + std::to_string(r[t]);
+		if(t<2)
+		{
+			check(name + ", error", rel_err(rk.a*rk.b.transpose(), low_rank), eps);
+			check(name + ", smallest rank", std::abs(rk.kt-3), 0.0);
+		}
+		else
+			check(name + ", rank at most the bound", std::max(rk.kt-r[t],0), 0.0);
+	}
+
+	// the batched products give the same factors as the blocks one by one
+	std::vector<rkmat> rk_batch(3);
+	std::vector<rkmat*> rk_ptr(3);
+	for(int b=0;b<3;b++)
+		rk_ptr[b] = &rk_batch[b];
+	h.RSVD(blks, rk_ptr, 0, eps);
+	for(int b=0;b<3;b++)
+	{
+		rkmat rk;
+		h.RSVD(blks[b], &rk, 0, eps);
+		Eigen::MatrixXd block = Eigen::MatrixXd(csc).block(start_row[b],start_col[b],rows[b],cols[b]);
+		std::string name = "RSVD of block " + std::to_string(b);
+		check(name + ", error", rel_err(rk.a*rk.b.transpose(), block), eps);
+		check(name + ", rank at most min(rows,cols)", std::max(rk.kt-std::min(rows[b],cols[b]),0), 0.0);
+		check(name + ", batched against one block", rel_err(rk_batch[b].a*rk_batch[b].b.transpose(), rk.a*rk.b.transpose()), 1e-12);
+		check(name + ", batched rank against one block", std::abs(rk_batch[b].kt-rk.kt), 0.0);
+	}
+}
+
+// a default constructed H-Matrix is the zero matrix: every product only scales 'y' by 'beta'
+static void verify_empty(void)
+{
+	hmat h;
+	int n = 7;
+	Eigen::VectorXd x = Eigen::VectorXd::Random(n);
+	Eigen::VectorXd y0 = Eigen::VectorXd::Random(n);
+	Eigen::VectorXd y = y0, yt = y0, y_par = y0;
+	h.apply(x, y, 2.0, 0.5);
+	check("empty H-Matrix, H*x", (y-0.5*y0).norm(), 0.0);
+	h.apply_transpose(x, yt, 2.0, 0.5);
+	check("empty H-Matrix, H^T*x", (yt-0.5*y0).norm(), 0.0);
+	h.apply_parallel(x, y_par, 2.0, 0.5, 2);
+	check("empty H-Matrix, apply_parallel", (y_par-0.5*y0).norm(), 0.0);
+	Eigen::MatrixXd X = Eigen::MatrixXd::Random(n,3);
+	Eigen::MatrixXd Y0 = Eigen::MatrixXd::Random(n,3);
+	Eigen::MatrixXd Y = Y0;
+	h.apply(X, Y, 2.0, 0.5);
+	check("empty H-Matrix, H*X", (Y-0.5*Y0).norm(), 0.0);
+	h.apply(x, y);
+	check("empty H-Matrix, H*x with beta 0", y.norm(), 0.0);
+}
+
+// compares the products of 'h' with the products of 'a'
+static void verify_apply(hmat& h, const SpMat& a, double tol)
+{
+	Eigen::VectorXd x = Eigen::VectorXd::Random(a.cols());
+	Eigen::VectorXd y;
+	h.apply(x, y);
+	check("H*x against A*x", rel_err(y, a*x), tol);
+
+	Eigen::VectorXd yt;
+	h.apply_transpose(x, yt);
+	check("H^T*x against A^T*x", rel_err(yt, a.transpose()*x), tol);
+
+	// y = alpha*H*x + beta*y
+	Eigen::VectorXd y0 = Eigen::VectorXd::Random(a.rows());
+	Eigen::VectorXd y_ab = y0;
+	h.apply(x, y_ab, 2.0, 0.5);
+	check("alpha*H*x+beta*y", rel_err(y_ab, 2.0*y + 0.5*y0), 1e-12);
+
+	// every leaf is applied to all columns at once
+	Eigen::MatrixXd X = Eigen::MatrixXd::Random(a.cols(),5);
+	Eigen::MatrixXd Y;
+	h.apply(X, Y);
+	check("H*X against A*X", rel_err(Y, a*X), tol);
+	Eigen::MatrixXd Y_col(a.rows(),X.cols());
+	for(int j=0;j<X.cols();j++)
+	{
+		Eigen::VectorXd y_j;
+		h.apply(Eigen::VectorXd(X.col(j)), y_j);
+		Y_col.col(j) = y_j;
+	}
+	check("H*X against H*x column by column", rel_err(Y, Y_col), 1e-12);
+
+	// the threads sum their partial results in a different order
+	int threads[3] = {1, 2, 4};
+	for(int t=0;t<3;t++)
+	{
+		Eigen::VectorXd y_par = y0;
+		h.apply_parallel(x, y_par, 2.0, 0.5, threads[t]);
+		check("apply_parallel with " + std::to_string(threads[t]) + " threads against apply", rel_err(y_par, y_ab), 1e-12);
+	}
+}
+
+// 'reorder_matrix' with a random permutation against Eigen's symmetric permutation; the rows within every column must stay sorted
+static void verify_reorder(const SpMat& a)
+{
+	int n = a.cols();
+	std::vector<unsigned int> idx_set(n);
+	Eigen::PermutationMatrix<Eigen::Dynamic,Eigen::Dynamic,int> perm(n); // maps index 'idx_set[i]' to 'i'
+	for(int i=0;i<n;i++)
+		idx_set[i] = i;
+	unsigned int seed = 4711;
+	for(int i=n-1;i>0;i--)
+	{
+		seed = seed*1103515245u + 12345u;
+		std::swap(idx_set[i], idx_set[(seed>>8)%(i+1)]);
+	}
+	for(int i=0;i<n;i++)
+		perm.indices()[idx_set[i]] = i;
+	SpMat s = a;
+	SpMat ref;
+	ref = a.twistedBy(perm);
+	if(!reorder_matrix(s, idx_set))
+	{
+		std::cout<<"FAILED reorder_matrix: permutation rejected"<<std::endl;
+		n_failed++;
+		return;
+	}
+	check("reorder_matrix against the symmetric permutation", (s-ref).norm(), 0.0);
+	int n_unsorted = 0;
+	for(int j=0;j<n;j++)
+		for(int k=s.outerIndexPtr()[j]+1;k<s.outerIndexPtr()[j+1];k++)
+			if(s.innerIndexPtr()[k-1]>=s.innerIndexPtr()[k])
+				n_unsorted++;
+	check("reorder_matrix keeps the rows sorted", n_unsorted, 0.0);
+}
+
+// 'reorder_matrix' must reject a matrix that is not square and an index set that is not a permutation, and leave the matrix unchanged
+static void verify_reorder_failure(const SpMat& a)
+{
+	int n = a.cols();
+	std::vector<unsigned int> dup(n), range(n);
+	for(int i=0;i<n;i++)
+	{
+		dup[i] = i;
+		range[i] = i;
+	}
+	dup[n-1] = 0;
+	range[n-1] = n;
+	SpMat s = a;
+	bool ok = reorder_matrix(s, dup);
+	check("reorder_matrix rejects a repeated index", ok ? 1.0 : (s-a).norm(), 0.0);
+	ok = reorder_matrix(s, range);
+	check("reorder_matrix rejects an index out of range", ok ? 1.0 : (s-a).norm(), 0.0);
+	SpMat r = a.topRows(n-1);
+	SpMat r0 = r;
+	ok = reorder_matrix(r, range);
+	check("reorder_matrix rejects a matrix that is not square", ok ? 1.0 : (r-r0).norm(), 0.0);
+}
+
+// writes 'bytes' to 'filename' and loads it into 'h2', which must reject it and keep giving 'y' for 'x'
+static void check_rejected(const std::string& name, const std::string& filename, const std::string& bytes, hmat& h2, const Eigen::VectorXd& x, const Eigen::VectorXd& y)
+{
+	std::ofstream op(filename.c_str(), std::ios::binary);
+	op.write(bytes.data(), bytes.size());
+	op.close();
+	bool loaded = h2.load(filename);
+	std::remove(filename.c_str());
+	if(loaded)
+	{
+		std::cout<<"FAILED "<<name<<": accepted by load"<<std::endl;
+		n_failed++;
+		return;
+	}
+	Eigen::VectorXd y_after;
+	h2.apply(x, y_after);
+	check(name + " rejected, H-Matrix unchanged", (y_after-y).norm(), 0.0);
+}
+
+// header of the H-Matrix file held by 'bytes'
+static hmat_file_header file_header(const std::string& bytes)
+{
+	hmat_file_header h;
+	std::memcpy(&h, bytes.data(), sizeof(h));
+	return h;
+}
+
+// record of block 'i' of the H-Matrix file held by 'bytes'; the records follow the header
+static hmat_file_block file_block(const std::string& bytes, int64_t i)
+{
+	hmat_file_block rec;
+	std::memcpy(&rec, bytes.data() + sizeof(hmat_file_header) + i*sizeof(hmat_file_block), sizeof(rec));
+	return rec;
+}
+
+static void set_file_block(std::string& bytes, int64_t i, const hmat_file_block& rec)
+{
+	std::memcpy(&bytes[sizeof(hmat_file_header) + i*sizeof(hmat_file_block)], &rec, sizeof(rec));
+}
+
+// saves 'h', loads the file again and compares the products; corrupted files must be rejected without changing the H-Matrix
+static void verify_save_load(hmat& h, int n)
+{
+	std::string filename = "verify_hmat_saved.bin";
+	Eigen::VectorXd x = Eigen::VectorXd::Random(n);
+	Eigen::VectorXd y, y_loaded;
+	h.apply(x, y);
+	hmat h2;
+	if(!h.save(filename) || !h2.load(filename))
+	{
+		std::cout<<"FAILED save/load roundtrip: file not written or not read"<<std::endl;
+		n_failed++;
+		std::remove(filename.c_str());
+		return;
+	}
+	h2.apply(x, y_loaded);
+	check("save/load roundtrip", (y_loaded-y).norm(), 0.0);
+
+	std::ifstream ip(filename.c_str(), std::ios::binary);
+	std::string bytes((std::istreambuf_iterator<char>(ip)), std::istreambuf_iterator<char>());
+	ip.close();
+	// the leaves of 'h2' are read from the mapped file: saving it again gives the same file, and 'recompress' copies the rk blocks before rewriting them
+	std::string resaved_name = "verify_hmat_resaved.bin";
+	bool resaved = h2.save(resaved_name);
+	std::ifstream ip2(resaved_name.c_str(), std::ios::binary);
+	std::string resaved_bytes((std::istreambuf_iterator<char>(ip2)), std::istreambuf_iterator<char>());
+	ip2.close();
+	std::remove(resaved_name.c_str());
+	check("save of a loaded H-Matrix gives the same file", (resaved && resaved_bytes==bytes) ? 0.0 : 1.0, 0.0);
+	hmat h3;
+	h3.load(filename);
+	h3.recompress(1e-10);
+	Eigen::VectorXd y_recompressed;
+	h3.apply(x, y_recompressed);
+	check("recompress of a loaded H-Matrix", rel_err(y_recompressed, y), 1e-8);
+	Eigen::VectorXd y_shared;
+	h2.apply(x, y_shared);
+	check("recompress of a loaded H-Matrix leaves the file unchanged", (y_shared-y).norm(), 0.0);
+
+	// 'h2' keeps 'filename' mapped, so the corrupted files are written to another file
+	std::string corrupt_name = "verify_hmat_corrupt.bin";
+	check_rejected("truncated file", corrupt_name, bytes.substr(0, bytes.size()/2), h2, x, y);
+	hmat_file_header header = file_header(bytes);
+	// the first block record is the root
+	std::string bad_type = bytes;
+	hmat_file_block root = file_block(bytes, 0);
+	root.type = 9;
+	set_file_block(bad_type, 0, root);
+	check_rejected("unknown block type", corrupt_name, bad_type, h2, x, y);
+	std::string cycle = bytes;
+	root = file_block(bytes, 0);
+	root.first_child = 0;
+	set_file_block(cycle, 0, root);
+	check_rejected("root block as its own child", corrupt_name, cycle, h2, x, y);
+	// the second block is the first child of the root; one row less leaves a gap in the root
+	std::string gap = bytes;
+	hmat_file_block child = file_block(bytes, 1);
+	child.rows--;
+	set_file_block(gap, 1, child);
+	check_rejected("children not tiling the root", corrupt_name, gap, h2, x, y);
+	// a file with a single 1 x 1 full block far away from the origin, with 2 column pointers and no entries: the root has to start at (0,0)
+	hmat_file_header far_header = header;
+	far_header.n_blocks = 1;
+	far_header.n_idx = 0;
+	far_header.n_rk_values = 0;
+	far_header.n_col_ptr = 2;
+	far_header.n_entries = 0;
+	hmat_file_block far_block;
+	std::memset(&far_block, 0, sizeof(far_block));
+	far_block.type = 2;
+	far_block.rows = 1;
+	far_block.cols = 1;
+	far_block.start_row = 1000000;
+	far_block.start_col = 1000000;
+	std::string far(sizeof(hmat_file_header) + sizeof(hmat_file_block) + 2*sizeof(int), '\0');
+	std::memcpy(&far[0], &far_header, sizeof(far_header));
+	set_file_block(far, 0, far_block);
+	check_rejected("root block away from the origin", corrupt_name, far, h2, x, y);
+
+	// an rk block whose rank exceeds min(rows,cols); zero rk values are appended to the rk section, so that only the rank itself is wrong.
+	// The rk section follows the block records and the index set, starting at a multiple of 8 bytes.
+	std::size_t rk_end = (sizeof(hmat_file_header) + header.n_blocks*sizeof(hmat_file_block) + header.n_idx*sizeof(uint32_t) + 7)/8*8 + header.n_rk_values*sizeof(double);
+	bool found = false;
+	for(int64_t i=0;i<header.n_blocks && !found;i++)
+	{
+		hmat_file_block rec = file_block(bytes, i);
+		if(rec.type!=1)
+			continue;
+		rec.kt = std::min(rec.rows, rec.cols) + 1;
+		int64_t n_extra = int64_t(rec.kt)*(rec.rows+rec.cols);
+		std::string bad_rank = bytes;
+		bad_rank.insert(rk_end, n_extra*sizeof(double), '\0');
+		hmat_file_header bad_header = header;
+		bad_header.n_rk_values += n_extra;
+		std::memcpy(&bad_rank[0], &bad_header, sizeof(bad_header));
+		set_file_block(bad_rank, i, rec);
+		check_rejected("rank above min(rows,cols)", corrupt_name, bad_rank, h2, x, y);
+		found = true;
+	}
+	if(!found)
+	{
+		std::cout<<"FAILED rank above min(rows,cols): no rk block to corrupt"<<std::endl;
+		n_failed++;
+	}
+	std::remove(filename.c_str()); // the mappings of 'h2' and 'h3' stay valid
+}
+
+// type and rank (0 for blocks which are not rk blocks) of every block of 'h'
+static std::vector<std::pair<int,int> > block_types(hmat& h)
+{
+	std::vector<std::pair<int,int> > types(h.n_blocks());
+	for(unsigned int i=0;i<h.n_blocks();i++)
+	{
+		const supermat* block = h.get_block(i);
+		types[i].first = block->type;
+		types[i].second = (block->type==1) ? block->r->kt : 0;
+	}
+	return types;
+}
+
+// sum of the ranks of the rk blocks of 'h'
+static int64_t total_rank(hmat& h)
+{
+	std::vector<std::pair<int,int> > types = block_types(h);
+	int64_t sum = 0;
+	for(unsigned int i=0;i<types.size();i++)
+	{
+		if(types[i].first==1)
+			sum += types[i].second;
+	}
+	return sum;
+}
+
+// a Laplacian without far couplings: the admissible blocks hold no entries, so they must all be zero blocks (type 4), which the products,
+// 'save' and 'load' skip; with only full and zero blocks the products agree with those of the matrix up to rounding
+static void verify_zero_blocks(void)
+{
+	SpMat a = test_matrix(24, 0);
+	std::vector<unsigned int> idx_set;
+	hmat* h = build_hmat(a, false, 4, 16, 16, 10, 1e-10, idx_set);
+	if(h==NULL)
+	{
+		n_failed++;
+		return;
+	}
+	std::vector<std::pair<int,int> > types = block_types(*h);
+	int n_type[5] = {0, 0, 0, 0, 0};
+	for(unsigned int i=0;i<types.size();i++)
+		n_type[std::min(std::max(types[i].first,0),4)]++;
+	check("admissible blocks without entries are zero blocks", (n_type[4]>0 && n_type[1]==0) ? 0.0 : 1.0, 0.0);
+
+	Eigen::VectorXd x = Eigen::VectorXd::Random(a.cols());
+	Eigen::VectorXd y, yt, y_par, y_loaded;
+	h->apply(x, y);
+	check("zero blocks, H*x against A*x", rel_err(y, a*x), 1e-15);
+	h->apply_transpose(x, yt);
+	check("zero blocks, H^T*x against A^T*x", rel_err(yt, a.transpose()*x), 1e-15);
+	h->apply_parallel(x, y_par, 1.0, 0.0, 4);
+	check("zero blocks, apply_parallel against apply", rel_err(y_par, y), 1e-15);
+	Eigen::MatrixXd X = Eigen::MatrixXd::Random(a.cols(),3);
+	Eigen::MatrixXd Y;
+	h->apply(X, Y);
+	check("zero blocks, H*X against A*X", rel_err(Y, a*X), 1e-15);
+
+	std::string filename = "verify_hmat_zero.bin";
+	hmat h2;
+	bool loaded = h->save(filename) && h2.load(filename);
+	std::remove(filename.c_str());
+	if(!loaded)
+	{
+		std::cout<<"FAILED zero blocks, save/load roundtrip: file not written or not read"<<std::endl;
+		n_failed++;
+	}
+	else
+	{
+		h2.apply(x, y_loaded);
+		check("zero blocks, save/load roundtrip", (y_loaded-y).norm(), 0.0);
+		check("zero blocks, loaded block types", (block_types(h2)==types) ? 0.0 : 1.0, 0.0);
+	}
+	delete h;
+}
+
+// 'recompress' of rk blocks whose rank is padded: every rk block of 'h' gets rank kt+p, p = min(kt, min(rows,cols)-kt), as a' = [a, a(:,0:p)] and
+// b' = [b with its first p columns halved, b(:,0:p)/2], which is the same matrix. After 'recompress' the ranks have to drop at least back to the
+// ones before, with the products within the tolerance. 'h' keeps the recompressed blocks.
+static void verify_recompress(hmat& h, int n)
+{
+	Eigen::VectorXd x = Eigen::VectorXd::Random(n);
+	Eigen::VectorXd y, y_padded;
+	h.apply(x, y);
+	int64_t rank = total_rank(h);
+	int64_t n_padded = 0;
+	for(unsigned int i=0;i<h.n_blocks();i++)
+	{
+		supermat* block = h.get_block(i);
+		if(block->type!=1)
+			continue;
+		rkmat* rk = block->r;
+		int p = std::min(rk->kt, std::min(block->rows,block->cols)-rk->kt);
+		Eigen::MatrixXd a_p(block->rows, rk->kt+p), b_p(block->cols, rk->kt+p);
+		a_p<<rk->a, rk->a.leftCols(p);
+		b_p<<rk->b, 0.5*rk->b.leftCols(p);
+		b_p.leftCols(p) *= 0.5;
+		rk->a.swap(a_p);
+		rk->b.swap(b_p);
+		rk->kt += p;
+		n_padded += p;
+	}
+	if(n_padded==0)
+	{
+		std::cout<<"FAILED recompress of padded ranks: no rank padded"<<std::endl;
+		n_failed++;
+		return;
+	}
+	check("padded ranks above the ranks of the H-Matrix", (total_rank(h)==rank+n_padded) ? 0.0 : 1.0, 0.0);
+	double tol = 1e-8;
+	h.recompress(tol);
+	check("recompress lowers the padded ranks", std::max(total_rank(h)-rank, int64_t(0)), 0.0);
+	h.apply(x, y_padded);
+	check("recompress of padded ranks, H*x", rel_err(y_padded, y), tol);
+}
+
+int main()
+{
+	verify_matrix_market();
+
+	SpMat a = test_matrix(80, 400);
+	verify_binary_matrix(a);
+	verify_reorder(a);
+	verify_reorder_failure(a);
+	verify_aca_isolated_entries();
+	verify_aca_residual_off_entries();
+	verify_rsvd();
+	verify_empty();
+	verify_parallel_matching(test_matrix(24, 40));
+	verify_zero_blocks();
+
+	// the steps of 'main'
+	int max_rank = 50;
+	double eps = 1e-10; // tighter than in 'main', so that the products can be compared closely
+	std::vector<unsigned int> idx_set;
+	hmat* h = build_hmat(a, true, 4, 80, 80, max_rank, eps, idx_set);
+	if(h==NULL)
+		return 1;
+	h->recompress(eps);
+
+	verify_apply(*h, a, 1e-8);
+	verify_save_load(*h, a.cols());
+	verify_recompress(*h, a.cols());
+	delete h;
+
+	if(n_failed>0)
+	{
+		std::cout<<n_failed<<" checks failed"<<std::endl;
+		return 1;
+	}
+	std::cout<<"All checks passed"<<std::endl;
+	return 0;
+}
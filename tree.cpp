@@ -2,161 +2,162 @@
 /// \brief Class for storage and manipulation of binary trees during H-Matrix build process.
 
 #include "tree.h"
-#include <queue>
 #include <iostream>
-#include <stack>
 
 //constructor
 
 tree::tree()
 {
-	node* ptr = new node;
-	root=ptr;
+	node root;
+	root.begin=0;
+	root.end=0;
+	root.first_child=0;
+	root.n_child=0;
+	root.level=0;
+	root.bt_idx=0;
+	nodes.push_back(root);
+	level_offset.push_back(0);
+	level_offset.push_back(1);
 }
 
 tree::tree(std::vector<unsigned int>& x)
 {
-	//custom constructor with 'x' as the root of binary tree
-	node* ptr = new node;
-	ptr->data=x;
-	ptr->left=NULL;
-	ptr->right=NULL;
-	ptr->level=0;
-	ptr->bt_idx = 0;
-	root = ptr;
+	//custom constructor with cluster 'x.at(0)' of the coarsest graph as the root of the tree
+	node root;
+	root.begin=0;
+	root.end=0;
+	root.first_child=0;
+	root.n_child=0;
+	root.level=0;
+	root.bt_idx = x.at(0);
+	nodes.push_back(root);
+	level_offset.push_back(0);
+	level_offset.push_back(1);
 }
 
 // returns pointer to root of tree
 node* tree::get_root()
 {
-	return root;
+	return &nodes[0];
+}
+
+node* tree::get_node(unsigned int i)
+{
+	return &nodes[i];
+}
+
+node* tree::get_child(const node* n, unsigned int c)
+{
+	return &nodes[n->first_child + c];
+}
+
+unsigned int tree::node_index(const node* n)
+{
+	return n - &nodes[0];
+}
+
+unsigned int tree::n_nodes(void)
+{
+	return nodes.size();
+}
+
+int tree::n_levels(void)
+{
+	return level_offset.size()-1;
+}
+
+unsigned int tree::level_begin(int l)
+{
+	return level_offset.at(l);
+}
+
+unsigned int tree::level_end(int l)
+{
+	return level_offset.at(l+1);
+}
+
+std::size_t tree::memory_usage(void)
+{
+	return nodes.capacity()*sizeof(node) + level_offset.capacity()*sizeof(unsigned int);
 }
 
 // graphs to binary tree
 void tree::graphs_to_tree(std::vector<graph_cluster*>& graphs)
 {
-	// this algorithm creates a binary tree from the set of coarsened graphs
-	// root of the binary tree is already initiated
-	// use BFS to fill the tree
+	// this algorithm creates a tree from the set of coarsened graphs
+	// root of the tree is already initiated
+	// BFS: the children of every node are appended to the node array, so the array is filled level by level
 	std::cout<<"graph to cluster loaded!"<<std::endl;
-	std::queue<node*> bt_nodes;
-	bt_nodes.push(root);
-	node* current_node = new node;
-
 	int current_level;
 	int n_graphs = graphs.size()-1;
 	unsigned int n_cluster; // cluster number
 	graph_cluster* current_graph;
 
-	while(!bt_nodes.empty())
+	nodes.resize(1);
+	for(unsigned int i=0;i<nodes.size();i++)
 	{
-		current_node = bt_nodes.front();
-		bt_nodes.pop();
-		//std::cout<<"current_node loaded!"<<std::endl;
-		// check for NULL POINTERS
-		if(current_node!=NULL)
+		// 'nodes' grows inside this loop, so nodes are only accessed by index
+		current_level = nodes[i].level;
+		nodes[i].first_child = nodes.size();
+		nodes[i].n_child = 0;
+		if(current_level == n_graphs + 1)
+			continue;
+		unsigned int dum_el = n_graphs - current_level;
+		current_graph = graphs.at(dum_el); // children of this current node are found in this graph
+		// bottom of the tree: a leaf cluster is not split into single indices
+		if(current_graph->has_leaf_clusters())
+			continue;
+		n_cluster = nodes[i].bt_idx;
+		std::vector<unsigned int> current_cluster = current_graph->get_cluster(n_cluster);
+		// one child per member of the cluster: two for heavy edge matching, up to k for k-way aggregation
+		for(std::vector<unsigned int>::iterator itr=current_cluster.begin();itr!=current_cluster.end();++itr)
 		{
-			//std::cout<<"loading current_level!"<<std::endl;
-			current_level = current_node->level;
-			//std::cout<<"n_graphs: "<<n_graphs<<std::endl;
-			//std::cout<<"current_level: "<<current_level<<std::endl;
-			if(current_level == n_graphs + 1)
-            {
-                //std::cout<<"Last level debug: "<<current_node->data.at(0)<<std::endl;
-                continue;
-            }
-            unsigned int dum_el = n_graphs - current_level;
-            unsigned int dum_el1;
-			current_graph = graphs.at(dum_el); // children of this current node are found in this graph
-			dum_el=0;
-			n_cluster = (current_node->data).at(dum_el);
-			//std::cout<<"n_clusters: "<<n_cluster<<std::endl;
-			std::vector<unsigned int> current_cluster = current_graph->get_cluster(n_cluster);
-			if(current_cluster.size()==2)
-			{
-				node* dum_node1 = new node;
-				node* dum_node2 = new node;
-				std::vector<unsigned int> dum_v;
-				dum_el1 = current_cluster.at(dum_el);
-				dum_v.push_back(dum_el1);
-				//std::cout<<"data1: "<<dum_el<<"; data1 (dum_v): "<<dum_el1<<std::endl;
-				dum_node1->data = dum_v;
-				dum_node1->left = NULL;
-				dum_node1->right = NULL;
-				dum_node1->level = current_level + 1;
-				dum_v.clear();
-				dum_el=1;
-				dum_el1 = current_cluster.at(dum_el);
-				dum_v.push_back(dum_el1);
-				//std::cout<<"data2: "<<dum_el<<"; data2 (dum_v): "<<dum_el1<<std::endl;
-				dum_node2->data = dum_v;
-				dum_node2->left = NULL;
-				dum_node2->right = NULL;
-				dum_node2->level = current_level + 1;
-				current_node->left = dum_node1;
-				current_node->right = dum_node2;
-				bt_nodes.push(dum_node1);
-				bt_nodes.push(dum_node2);
-			}
-			else
-			{
-				node* dum_node1 = new node;
-				std::vector<unsigned int> dum_v;
-				dum_el=0;
-				dum_el1=current_cluster.at(dum_el);
-				dum_v.push_back(dum_el1);
-                //std::cout<<"data(single_node): "<<dum_el<<"; data(single_node) (dum_v): "<<dum_el1<<std::endl;
-				dum_node1->data = dum_v;
-				dum_node1->left = NULL;
-				dum_node1->right = NULL;
-				dum_node1->level = current_level + 1;
-				current_node->left = dum_node1;
-				current_node->right = NULL;
-				bt_nodes.push(dum_node1);
-			}
-
+			node dum_node1;
+			dum_node1.begin = 0;
+			dum_node1.end = 0;
+			dum_node1.first_child = 0;
+			dum_node1.n_child = 0;
+			dum_node1.bt_idx = *itr;
+			dum_node1.level = current_level + 1;
+			nodes.push_back(dum_node1);
 		}
+		nodes[i].n_child = current_cluster.size();
+	}
+
+	// levels are non-decreasing in BFS order
+	level_offset.clear();
+	for(unsigned int i=0;i<nodes.size();i++)
+	{
+		while(int(level_offset.size())<=nodes[i].level)
+			level_offset.push_back(i);
 	}
-	current_node = NULL;
-	delete current_node;
+	level_offset.push_back(nodes.size());
 }
 
 // maps leaf nodes and updates index set
 void tree::map_index(std::vector<graph_cluster*>& graphs, std::vector<unsigned int>& v)
 {
 	// this function creates an implicit mapping of the indices as the location (index) of elements are similar to mapping
-	// BFS of tree
-	std::queue <node*> bt_nodes;
-	bt_nodes.push(root);
-	node* current_node = new node;
-    //std::cout<<"DB: index mapping"<<std::endl;
-	while(!bt_nodes.empty())
+	// all leaves are on the last level, so the scan over the node array visits them from left to right
+	int n_graphs = graphs.size()-1;
+	for(unsigned int i=0;i<nodes.size();i++)
 	{
-		current_node = bt_nodes.front();
-		bt_nodes.pop();
-        //std::cout<<"DB1"<<std::endl;
-		if(current_node!=NULL)
+		node* current_node = &nodes[i];
+		if(current_node->n_child!=0)
+			continue;
+		// a leaf is one index of the original matrix, or a leaf cluster of the finest graph
+		// its cluster is the range of positions of these indices in the index set
+		current_node->begin = v.size();
+		if(current_node->level == n_graphs + 1)
+			v.push_back(current_node->bt_idx);
+		else
 		{
-            //std::cout<<"DB2: "<<current_node->left<<std::endl;
-		    //std::cout<<"DB3: "<<current_node->right<<std::endl;
-			if(current_node->left==NULL && current_node->right==NULL)
-			{
-				std::vector<unsigned int> current_data = current_node->data;
-				unsigned int dum_el=0;
-				//std::cout<<"DB4: "<<current_data.at(dum_el)<<std::endl;
-				v.push_back(current_data.at(dum_el));
-			}
-			else
-			{
-				bt_nodes.push(current_node->left);
-				bt_nodes.push(current_node->right);
-			}
+			std::vector<unsigned int> current_cluster = graphs.at(n_graphs - current_node->level)->get_cluster(current_node->bt_idx);
+			v.insert(v.end(),current_cluster.begin(),current_cluster.end());
 		}
+		current_node->end = v.size();
 	}
 
-	current_node=NULL;
-	delete current_node;
-
 	std::cout<<"-----------------------------------------------------"<<std::endl;
 	std::cout<<"Index mapping set: ";
 
@@ -168,199 +169,63 @@ void tree::map_index(std::vector<graph_cluster*>& graphs, std::vector<unsigned i
 	}
 
 	std::cout<<std::endl;
-
-	unsigned int level_count=0; // used to maintain count of level nodes; will be useful for filtering NULL nodes
-	int current_level=0;
-
-	std::vector<unsigned int> dum_v;
-
-	bt_nodes.push(root);
-
-	current_node = NULL;
-
-	while(!bt_nodes.empty())
-	{
-		current_node = bt_nodes.front();
-		bt_nodes.pop();
-		if(current_node!=NULL)
-		{
-			if(current_node->level != current_level)
-			{
-				current_level+=1;
-				level_count=0;
-			}
-			dum_v.clear();
-			dum_v.push_back(level_count);
-			current_node->data = dum_v;
-			level_count+=1;
-			bt_nodes.push(current_node->left);
-			bt_nodes.push(current_node->right);
-		}
-		//std::cout<<"current_level: "<<current_level<<" level_count: "<<level_count<<std::endl;
-
-	}
-	current_node=NULL;
-	delete current_node;
 }
 
 // generates cluster tree using binary tree
-void tree::cluster_tree(int sz_mat)
+void tree::cluster_tree(void)
 {
-	std::queue <node*> bt_nodes;
-	std::stack <node*> bt_nodes_reverse;
-	bt_nodes.push(root);
-
-	node* current_node = new node;
-    //std::cout<<"stack collection started."<<std::endl;
-	// collect all node pointers in a stack
-	while(!bt_nodes.empty())
-	{
-		current_node = bt_nodes.front();
-		bt_nodes_reverse.push(current_node);
-		bt_nodes.pop();
-
-		if(current_node != NULL)
-		{
-			bt_nodes.push(current_node->left);
-			bt_nodes.push(current_node->right);
-		}
-	}
-	//std::cout<<"stack collection completed."<<std::endl;
-	// build cluster tree using stack
-	//std::cout<<"cluster tree build started."<<std::endl;
-	while(!bt_nodes_reverse.empty())
+	// reverse scan: the children of a node are always behind it in the array
+	for(unsigned int i=nodes.size();i-->0;)
 	{
-		current_node = bt_nodes_reverse.top();
-		bt_nodes_reverse.pop();
-
-		if(current_node!=NULL)
-		{
-			if(current_node->left==NULL && current_node->right==NULL)
-			{
-				// leaf node
-				// dont do anything
-				//std::cout<<"leaf node."<<std::endl;
-				continue;
-			}
-			else
-			{
-			    //std::cout<<"std node."<<std::endl;
-				 // collect children in a vector
-				std::vector<unsigned int> child1, child2;
-				if(current_node->left!=NULL)
-					child1 = current_node->left->data;
-				if(current_node->right!=NULL)
-					child2 = current_node->right->data;
-				if(child1.empty())
-				{
-					current_node->data = child2;
-				}
-				else if(child2.empty())
-				{
-					current_node->data = child1;
-				}
-				else
-				{
-					child1.insert(child1.end(),child2.begin(),child2.end());
-					current_node->data = child1;
-				}
-
-			}
-		}
+		node* current_node = &nodes[i];
+		if(current_node->n_child==0)
+			continue; // leaf node: range set by 'map_index'
+		// the children are contiguous: the cluster spans from the first to the last child
+		current_node->begin = nodes[current_node->first_child].begin;
+		current_node->end = nodes[current_node->first_child + current_node->n_child - 1].end;
 	}
 	std::cout<<"cluster tree build completed."<<std::endl;
-	current_node=NULL;
-	delete current_node;
 }
 
 //updates index corresponding to binary tree
 void tree::update_bt_idx(void)
 {
-	std::queue <node*> bt_nodes;
-	bt_nodes.push(root);
-	node* current_node = new node;
-	while(!bt_nodes.empty())
-	{
-		current_node = bt_nodes.front();
-		bt_nodes.pop();
-		if(current_node!=NULL)
-		{
-			current_node->bt_idx = current_node->data.at(0);
-			bt_nodes.push(current_node->left);
-			bt_nodes.push(current_node->right);
-		}
-	}
-	current_node = NULL;
-	delete current_node;
+	// 'bt_idx' becomes the position of the node within its level, i.e. the vertex of the reordered graph of that level
+	for(unsigned int i=0;i<nodes.size();i++)
+		nodes[i].bt_idx = i - level_offset[nodes[i].level];
 }
 
 void tree::index_tree(void)
 {
 	std::cout<<"-----------------------------------------------------"<<"\n";
-	std::queue <node*> bt_nodes;
-	bt_nodes.push(root);
 	std::cout<<"BFS of binary tree: \n";
-	node* current_node = new node;
-	while(!bt_nodes.empty())
+	for(unsigned int i=0;i<nodes.size();i++)
 	{
-		current_node = bt_nodes.front();
-		bt_nodes.pop();
-		if(current_node!=NULL)
-		{
-			std::cout<<" <- ";
-			std::cout<<" "<<current_node->bt_idx<<" ";
-			std::cout<<"-> ";
-			bt_nodes.push(current_node->left);
-			bt_nodes.push(current_node->right);
-		}
-		else
-		{
-			std::cout<<" <- "<<" NULL "<<" -> ";
-		}
+		std::cout<<" <- ";
+		std::cout<<" "<<nodes[i].bt_idx<<" ";
+		std::cout<<"-> ";
 	}
 	std::cout<<"\n";
-	current_node=NULL;
-	delete current_node;
 }
 
 // overload print function
 std::ostream& operator<<(std::ostream& os, tree& bt)
 {
 	os<<"-----------------------------------------------------"<<"\n";
-	std::queue <node*> bt_nodes;
-	bt_nodes.push(bt.get_root());
 	os<<"BFS of binary tree: \n";
-	node* current_node = new node;
-	while(!bt_nodes.empty())
+	for(unsigned int i=0;i<bt.n_nodes();i++)
 	{
-		current_node = bt_nodes.front();
-		bt_nodes.pop();
-		if(current_node!=NULL)
-		{
-		    //std::cout<<"dbb"<<std::endl;
-		    if(current_node->data.empty())
-                os<<"data is NULL"<<std::endl;
-			std::vector<unsigned int> current_data;
-            current_data= current_node->data;
-			//std::cout<<"dbb1"<<std::endl;
-			os<<" <- level: "<< current_node->level<<" - ";
-			os<<" <- ";
-			for(std::vector<unsigned int>::iterator itr = current_data.begin(); itr!= current_data.end(); ++ itr)
-			{
-				os<<" "<<*itr<<" ";
-			}
-			os<<"-> ";
-			bt_nodes.push(current_node->left);
-			bt_nodes.push(current_node->right);
-			current_data.clear();
-		}
-		else
+		node* current_node = bt.get_node(i);
+		if(current_node->size()==0)
+			os<<"cluster is empty"<<std::endl;
+		os<<" <- level: "<< current_node->level<<" - ";
+		os<<" <- ";
+		for(unsigned int j=current_node->begin; j<current_node->end; j++)
 		{
-			os<<" <- "<<" NULL "<<" -> ";
+			os<<" "<<j<<" ";
 		}
+		os<<"-> ";
 	}
 	os<<"\n";
-	current_node=NULL;
-	delete current_node;
 	return os;
 }
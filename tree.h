@@ -1,5 +1,5 @@
 //class for general tree: depending on application can be used as binary or quad-tree
-//! This class can be used for a binary tree.
+//! This class can be used for a binary tree or, with k-way aggregation, for a tree with up to k children per node.
 #ifndef TREE_H
 #define TREE_H
 
@@ -8,38 +8,57 @@
 #include "graph_cluster.h"
 
 /// "node" represents a node in the tree and it consists of the following attributes:
-/// 1. data: vector to hold data (in this case subsets of the index set).
-/// 2. left: pointer to the left child node in the tree.
-/// 3. right: pointer to the right child node in the tree.
-/// 4. level: level number of the node.
-/// 5. bt_idx: index number of the node from index tree; used to store cluster and index tree in the same object.
+/// 1. begin, end: the cluster, i.e. the indices [begin,end) of the reordered matrix; set by 'map_index' (leaves) and 'cluster_tree' (other nodes).
+/// 2. first_child, n_child: the children are stored contiguously in the node array of the tree, from left to right; two for heavy edge matching, up to k for k-way aggregation.
+/// 3. level: level number of the node.
+/// 4. bt_idx: index number of the node from index tree, i.e. the vertex of the graph of its level; used to store cluster and index tree in the same object.
 struct node
 {
-	std::vector<unsigned int> data;
-	node* left;
-	node* right;
+	unsigned int begin,end;
+	unsigned int first_child;
+	unsigned int n_child;
 	int level;
 	int bt_idx;
+	/// Number of indices in the cluster.
+	unsigned int size(void) const {return end-begin;}
 };
 
 /// Class to store and manipulate index tree and cluster tree.
+/// The nodes are stored in one array in BFS order: the root is the first node, the nodes of every level and the children of every node are contiguous.
+/// All traversals are linear scans over this array.
 class tree
 {
-	node* root;
+	std::vector<node> nodes;
+	std::vector<unsigned int> level_offset; // the nodes of level 'l' are nodes[level_offset[l]] ... nodes[level_offset[l+1]-1]
 public:
     /// Default constructor for the tree.
 	tree();
-	/// Custom constructor with the input vector as the root.
-	tree(std::vector<unsigned int>&);
+	/// Custom constructor; the root is the cluster 'x.at(0)' of the coarsest graph.
+	tree(std::vector<unsigned int>& x);
 	/// Helper function; returns a pointer to the root of the tree.
 	node* get_root(void);
-    /// This method uses the vector of graphs from the coarsening process to create binary tree, based on DFS traversal.
+	/// Returns a pointer to node 'i' of the node array.
+	node* get_node(unsigned int i);
+	/// Returns a pointer to child 'c' of the given node.
+	node* get_child(const node*, unsigned int c);
+	/// Index of the given node in the node array.
+	unsigned int node_index(const node*);
+	/// Number of nodes in the tree.
+	unsigned int n_nodes(void);
+	/// Number of levels in the tree.
+	int n_levels(void);
+	/// The nodes of level 'l' are the nodes level_begin(l) ... level_end(l)-1 of the node array.
+	unsigned int level_begin(int l);
+	unsigned int level_end(int l);
+	/// Memory held by the node array and the level offsets in bytes.
+	std::size_t memory_usage(void);
+    /// This method uses the vector of graphs from the coarsening process to create the tree, based on BFS traversal; every cluster of a graph becomes a node with one child per member.
 	void graphs_to_tree(std::vector<graph_cluster*>&);
 	/// This method maps the leaf nodes from left to right in the input index set. Mapping set is used to permute the original matrix so that clustered rows and cols are together, which is important when constructing the block cluster tree.
-	/// It also modifies the index tree according to the index set to create an ascending tree at each level.
+	/// It also assigns every leaf its range of positions in the index set.
 	void map_index(std::vector<graph_cluster*>&, std::vector<unsigned int>&);
-	/// Generates the cluster tree from bottom to top; stores in the same object.
-	void cluster_tree(int);
+	/// Generates the cluster tree from bottom to top; stores in the same object. The range of a node spans the ranges of its children, so this costs O(#nodes).
+	void cluster_tree(void);
 	/// Updates the 'bt_idx' attribute at every node to accommodate both index and cluster tree in one object.
 	void update_bt_idx(void);
 	/// Prints the index tree on the console.